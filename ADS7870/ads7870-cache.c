@@ -0,0 +1,109 @@
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include "ads7870-spi.h"
+#include "ads7870-snap.h"
+#include "ads7870-cache.h"
+#include "ads7870-sched.h"
+#include "ads7870-stats.h"
+#include "ads7870-uapi.h"
+
+/*
+ * Per-channel sample cache
+ *
+ * A one-shot read is served from the cache if the cached sample
+ * was started no more than cache_max_age_us before the read
+ * arrived. Misses on the same channel are coalesced: the first
+ * reader converts while holding the channel mutex, readers queued
+ * behind it pick up its result when it is fresh enough for them.
+ * With the default age of 0 only conversions started after a
+ * read arrived are shared with it.
+ */
+
+static unsigned int cache_max_age_us = 0;
+module_param(cache_max_age_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(cache_max_age_us, "Maximum age of a cached sample served to read() in microseconds (default 0)");
+
+struct ads7870_cache_entry {
+  struct mutex convert_lock;	/* Held by the reader converting on a miss */
+  s64 start_ns;			/* Time the cached conversion was started */
+  s16 value;
+  bool valid;
+};
+
+static struct ads7870_cache_entry cache[ADS7870_NBR_CHANNELS];
+static DEFINE_SPINLOCK(cache_lock);	/* Protects value, start_ns and valid */
+
+static bool ads7870_cache_lookup(struct ads7870_cache_entry *e, s64 oldest_ns, s16* value)
+{
+  bool hit;
+
+  spin_lock(&cache_lock);
+  hit = e->valid && e->start_ns >= oldest_ns;
+  if(hit)
+    *value = e->value;
+  spin_unlock(&cache_lock);
+
+  return hit;
+}
+
+void ads7870_cache_update(u8 channel, s16 value, s64 start_ns)
+{
+  struct ads7870_cache_entry *e = &cache[channel & (ADS7870_NBR_CHANNELS - 1)];
+
+  spin_lock(&cache_lock);
+  /* Never replace a sample by an older one */
+  if(!e->valid || start_ns >= e->start_ns)
+  {
+    e->value = value;
+    e->start_ns = start_ns;
+    e->valid = true;
+  }
+  spin_unlock(&cache_lock);
+}
+
+int ads7870_cache_convert(u8 channel, s16* value)
+{
+  struct ads7870_cache_entry *e = &cache[channel & (ADS7870_NBR_CHANNELS - 1)];
+  s64 oldest_ns, start_ns;
+  int err;
+
+  oldest_ns = ktime_to_ns(ktime_get()) - (s64)cache_max_age_us * NSEC_PER_USEC;
+
+  /* Fresh enough sample available */
+  if(ads7870_cache_lookup(e, oldest_ns, value))
+  {
+    ads7870_stats_inc(cache_hits);
+    return 0;
+  }
+
+  if(mutex_lock_interruptible(&e->convert_lock))
+    return -ERESTARTSYS;
+
+  /* Another reader may have converted while we waited */
+  if(ads7870_cache_lookup(e, oldest_ns, value))
+  {
+    mutex_unlock(&e->convert_lock);
+    ads7870_stats_inc(cache_hits);
+    return 0;
+  }
+
+  start_ns = ktime_to_ns(ktime_get());
+  err = ads7870_sched_convert(channel, value);
+  if(!err)
+    ads7870_cache_update(channel, *value, start_ns);
+  ads7870_snap_publish(channel, *value, err, ktime_get());
+
+  mutex_unlock(&e->convert_lock);
+  return err;
+}
+
+void ads7870_cache_init(void)
+{
+  int ch;
+
+  for(ch = 0; ch < ADS7870_NBR_CHANNELS; ch++)
+    mutex_init(&cache[ch].convert_lock);
+}
@@ -0,0 +1,9 @@
+#ifndef ADS7870_CACHE_H
+#define ADS7870_CACHE_H
+#include <linux/types.h>
+
+int ads7870_cache_convert(u8 channel, s16* value);
+void ads7870_cache_update(u8 channel, s16 value, s64 start_ns);
+void ads7870_cache_init(void);
+
+#endif
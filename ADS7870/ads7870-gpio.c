@@ -0,0 +1,179 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/gpio.h>
+#include <linux/mutex.h>
+#include <linux/module.h>
+#include "ads7870.h"
+#include "ads7870-spi.h"
+#include "ads7870-gpio.h"
+
+/*
+ * ADS7870 digital I/O
+ *
+ * The four digital I/O pins D0-D3 are registered as a gpio_chip.
+ * Direction and output state are cached, so reading back an output
+ * costs no bus traffic. Only input pins are read from the device.
+ *
+ * gpiolib of this kernel has no multiple-pin calls, so pins set
+ * through it cost a write each. Other drivers change several pins
+ * with one write of DIGIOSTATE through ads7870_gpio_set_mask(), and
+ * read them in one transaction with ads7870_gpio_get_mask().
+ */
+
+#define ADS7870_NBR_GPIO	4
+#define ADS7870_GPIO_MASK	((1 << ADS7870_NBR_GPIO) - 1)
+
+static int gpio_base = -1;
+module_param(gpio_base, int, S_IRUGO);
+MODULE_PARM_DESC(gpio_base, "First GPIO number of the ADS7870 digital I/O, -1 for dynamic (default -1)");
+
+static DEFINE_MUTEX(gpio_lock);		/* Protects the cached registers */
+static u8 gpio_dir = 0;			/* DIGIOCTRL, 1 = output */
+static u8 gpio_state = 0;		/* DIGIOSTATE output latch */
+static bool gpio_registered = false;
+
+/*
+ * Read the pins in mask, D0 being bit 0
+ * Inputs are read in one transaction, outputs come from the cache.
+ */
+int ads7870_gpio_get_mask(unsigned long mask, unsigned long *bits)
+{
+  u8 value = 0;
+  int err = 0;
+
+  mutex_lock(&gpio_lock);
+
+  if(mask & ~gpio_dir & ADS7870_GPIO_MASK)
+    err = ads7870_spi_read_reg8(ADS7870_DIGIOSTATE, &value);
+
+  if(!err)
+  {
+    value = (value & ~gpio_dir) | (gpio_state & gpio_dir);
+    *bits = value & mask & ADS7870_GPIO_MASK;
+  }
+
+  mutex_unlock(&gpio_lock);
+  return err;
+}
+EXPORT_SYMBOL(ads7870_gpio_get_mask);
+
+/*
+ * Set the output latch of the pins in mask to bits
+ * All pins change with one write, none if nothing changes.
+ */
+int ads7870_gpio_set_mask(unsigned long mask, unsigned long bits)
+{
+  u8 state;
+  int err = 0;
+
+  mutex_lock(&gpio_lock);
+
+  state = (gpio_state & ~mask) | (bits & mask);
+  state &= ADS7870_GPIO_MASK;
+
+  if(state != gpio_state)
+    err = ads7870_spi_write_reg8(ADS7870_DIGIOSTATE, state);
+  if(!err)
+    gpio_state = state;
+
+  mutex_unlock(&gpio_lock);
+  return err;
+}
+EXPORT_SYMBOL(ads7870_gpio_set_mask);
+
+static int ads7870_gpio_get(struct gpio_chip *chip, unsigned offset)
+{
+  unsigned long bits = 0;
+  int err;
+
+  err = ads7870_gpio_get_mask(1 << offset, &bits);
+  if(err)
+    return err;
+
+  return !!bits;
+}
+
+static void ads7870_gpio_set(struct gpio_chip *chip, unsigned offset, int value)
+{
+  ads7870_gpio_set_mask(1 << offset, value ? 1 << offset : 0);
+}
+
+static int ads7870_gpio_set_direction(unsigned offset, bool output, int value)
+{
+  u8 dir, state;
+  int err = 0;
+
+  mutex_lock(&gpio_lock);
+
+  /* Latch the output level before enabling the driver */
+  if(output)
+  {
+    state = value ? gpio_state | (1 << offset) : gpio_state & ~(1 << offset);
+    if(state != gpio_state)
+      err = ads7870_spi_write_reg8(ADS7870_DIGIOSTATE, state);
+    if(!err)
+      gpio_state = state;
+  }
+
+  dir = output ? gpio_dir | (1 << offset) : gpio_dir & ~(1 << offset);
+  if(!err && dir != gpio_dir)
+    err = ads7870_spi_write_reg8(ADS7870_DIGIOCTRL, dir);
+  if(!err)
+    gpio_dir = dir;
+
+  mutex_unlock(&gpio_lock);
+  return err;
+}
+
+static int ads7870_gpio_direction_input(struct gpio_chip *chip, unsigned offset)
+{
+  return ads7870_gpio_set_direction(offset, false, 0);
+}
+
+static int ads7870_gpio_direction_output(struct gpio_chip *chip, unsigned offset, int value)
+{
+  return ads7870_gpio_set_direction(offset, true, value);
+}
+
+static struct gpio_chip ads7870_gpio_chip = {
+  .label            = "ads7870",
+  .owner            = THIS_MODULE,
+  .direction_input  = ads7870_gpio_direction_input,
+  .direction_output = ads7870_gpio_direction_output,
+  .get              = ads7870_gpio_get,
+  .set              = ads7870_gpio_set,
+  .ngpio            = ADS7870_NBR_GPIO,
+  .can_sleep        = 1,
+};
+
+int ads7870_gpio_init(void)
+{
+  int err;
+
+  /* All pins start as inputs, with the output latch cleared */
+  err = ads7870_spi_write_reg8(ADS7870_DIGIOCTRL, 0);
+  if(!err)
+    err = ads7870_spi_write_reg8(ADS7870_DIGIOSTATE, 0);
+  if(err)
+    return err;
+
+  ads7870_gpio_chip.dev = ads7870_spi_dev();
+  ads7870_gpio_chip.base = gpio_base;
+
+  err = gpiochip_add(&ads7870_gpio_chip);
+  if(err)
+    return err;
+
+  gpio_registered = true;
+  return 0;
+}
+
+void ads7870_gpio_exit(void)
+{
+  if(!gpio_registered)
+    return;
+
+  if(gpiochip_remove(&ads7870_gpio_chip))
+    mps_err("Digital I/O still in use at exit\n");
+  gpio_registered = false;
+}
@@ -0,0 +1,9 @@
+#ifndef ADS7870_GPIO_H
+#define ADS7870_GPIO_H
+
+int ads7870_gpio_get_mask(unsigned long mask, unsigned long *bits);
+int ads7870_gpio_set_mask(unsigned long mask, unsigned long bits);
+int ads7870_gpio_init(void);
+void ads7870_gpio_exit(void);
+
+#endif
@@ -0,0 +1,269 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/pm_runtime.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include "ads7870.h"
+#include "ads7870-spi.h"
+#include "ads7870-pm.h"
+
+/*
+ * Runtime power management
+ *
+ * After autosuspend_ms without conversions the oscillator,
+ * reference and buffer are powered down. On wake-up they are
+ * powered up again and conversions wait only for the reference
+ * settling time, which is measured at probe unless ref_settle_us
+ * is given. Wake latency and time spent active and suspended are
+ * reported in the pm_stats attribute of the SPI device.
+ */
+
+#define ADS7870_SETTLE_MAX_US	10000
+
+static int autosuspend_ms = -1;
+module_param(autosuspend_ms, int, S_IRUGO);
+MODULE_PARM_DESC(autosuspend_ms, "Idle time before the reference is powered down in ms, -1 to keep it on (default -1)");
+
+static unsigned int ref_settle_us = 0;
+module_param(ref_settle_us, uint, S_IRUGO);
+MODULE_PARM_DESC(ref_settle_us, "Reference settling time after wake-up in microseconds, 0 to measure at load (default 0)");
+
+static int settle_channel = 0;
+module_param(settle_channel, int, S_IRUGO);
+MODULE_PARM_DESC(settle_channel, "Channel with a stable input used to measure settling, -1 to use the maximum (default 0)");
+
+static unsigned int settle_tolerance = 2;
+module_param(settle_tolerance, uint, S_IRUGO);
+MODULE_PARM_DESC(settle_tolerance, "Deviation in LSB accepted as settled (default 2)");
+
+static struct {
+  unsigned long wakeups;
+  unsigned long suspends;
+  s64 last_wake_ns;
+  s64 max_wake_ns;
+  s64 total_wake_ns;
+  s64 active_ns;
+  s64 suspended_ns;
+  ktime_t since;		/* Time of the last state change */
+  bool suspended;
+} pm_stats;
+
+static DEFINE_SPINLOCK(pm_stats_lock);
+static struct device *pm_dev = NULL;	/* Set when runtime PM is enabled */
+static unsigned int pm_settle_us = ADS7870_SETTLE_MAX_US;
+
+static void ads7870_pm_account(bool suspended, s64 wake_ns)
+{
+  ktime_t now = ktime_get();
+  s64 spent = ktime_to_ns(ktime_sub(now, pm_stats.since));
+
+  spin_lock(&pm_stats_lock);
+  if(pm_stats.suspended)
+    pm_stats.suspended_ns += spent;
+  else
+    pm_stats.active_ns += spent;
+
+  if(suspended)
+    pm_stats.suspends++;
+  else
+  {
+    pm_stats.wakeups++;
+    pm_stats.last_wake_ns = wake_ns;
+    pm_stats.total_wake_ns += wake_ns;
+    if(wake_ns > pm_stats.max_wake_ns)
+      pm_stats.max_wake_ns = wake_ns;
+  }
+
+  pm_stats.suspended = suspended;
+  pm_stats.since = now;
+  spin_unlock(&pm_stats_lock);
+}
+
+static int ads7870_runtime_suspend(struct device *dev)
+{
+  int err;
+
+  err = ads7870_spi_write_reg8(ADS7870_REFOSC, 0);
+  if(err)
+    return err;
+
+  ads7870_pm_account(true, 0);
+  return 0;
+}
+
+static int ads7870_runtime_resume(struct device *dev)
+{
+  ktime_t start = ktime_get();
+  int err;
+
+  err = ads7870_spi_write_reg8(ADS7870_REFOSC, ADS7870_REFOSC_RUN);
+  if(err)
+    return err;
+
+  /* Wait only as long as the reference was measured to need */
+  usleep_range(pm_settle_us, pm_settle_us + pm_settle_us / 8 + 1);
+
+  ads7870_pm_account(false, ktime_to_ns(ktime_sub(ktime_get(), start)));
+  return 0;
+}
+
+const struct dev_pm_ops ads7870_pm_ops = {
+  SET_RUNTIME_PM_OPS(ads7870_runtime_suspend, ads7870_runtime_resume, NULL)
+};
+
+/*
+ * Reference held by every conversion
+ * Before runtime PM is enabled the device is always powered.
+ */
+int ads7870_pm_get(void)
+{
+  int err;
+
+  if(!pm_dev)
+    return 0;
+
+  err = pm_runtime_get_sync(pm_dev);
+  if(err < 0)
+  {
+    pm_runtime_put_noidle(pm_dev);
+    return err;
+  }
+
+  return 0;
+}
+
+void ads7870_pm_put(void)
+{
+  if(!pm_dev)
+    return;
+
+  pm_runtime_mark_last_busy(pm_dev);
+  pm_runtime_put_autosuspend(pm_dev);
+}
+
+/*
+ * Measure the reference settling time
+ * Powers the reference down and up again, and converts
+ * settle_channel until it is back within settle_tolerance of the
+ * settled value. A margin of 25% is added to the time found.
+ */
+static unsigned int ads7870_pm_measure_settle(void)
+{
+  s16 settled, value;
+  ktime_t start;
+  s64 elapsed_us;
+  int err;
+
+  if(settle_channel < 0)
+    return ADS7870_SETTLE_MAX_US;
+
+  /* Let the reference settle completely after power-up */
+  usleep_range(ADS7870_SETTLE_MAX_US, 2 * ADS7870_SETTLE_MAX_US);
+  err = ads7870_convert(settle_channel, &settled);
+  if(!err)
+    err = ads7870_spi_write_reg8(ADS7870_REFOSC, 0);
+  if(err)
+    return ADS7870_SETTLE_MAX_US;
+
+  /* Let the reference discharge */
+  msleep(10);
+
+  start = ktime_get();
+  err = ads7870_spi_write_reg8(ADS7870_REFOSC, ADS7870_REFOSC_RUN);
+  do
+  {
+    if(!err)
+      err = ads7870_convert(settle_channel, &value);
+    elapsed_us = ktime_to_us(ktime_sub(ktime_get(), start));
+  }
+  while(!err && abs(value - settled) > settle_tolerance &&
+        elapsed_us < ADS7870_SETTLE_MAX_US);
+
+  if(err || elapsed_us >= ADS7870_SETTLE_MAX_US)
+    return ADS7870_SETTLE_MAX_US;
+
+  return elapsed_us + elapsed_us / 4 + 1;
+}
+
+static ssize_t ads7870_pm_stats_show(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+  s64 active, suspended, spent;
+
+  spin_lock(&pm_stats_lock);
+  spent = ktime_to_ns(ktime_sub(ktime_get(), pm_stats.since));
+  active = pm_stats.active_ns + (pm_stats.suspended ? 0 : spent);
+  suspended = pm_stats.suspended_ns + (pm_stats.suspended ? spent : 0);
+  spin_unlock(&pm_stats_lock);
+
+  return sprintf(buf,
+                 "state %s\n"
+                 "settle_us %u\n"
+                 "wakeups %lu\n"
+                 "suspends %lu\n"
+                 "last_wake_us %lld\n"
+                 "max_wake_us %lld\n"
+                 "avg_wake_us %lld\n"
+                 "active_ms %lld\n"
+                 "suspended_ms %lld\n",
+                 pm_stats.suspended ? "suspended" : "active",
+                 pm_settle_us,
+                 pm_stats.wakeups,
+                 pm_stats.suspends,
+                 div_s64(pm_stats.last_wake_ns, NSEC_PER_USEC),
+                 div_s64(pm_stats.max_wake_ns, NSEC_PER_USEC),
+                 pm_stats.wakeups ?
+                 (s64)div_u64(div64_u64(pm_stats.total_wake_ns, pm_stats.wakeups),
+                              NSEC_PER_USEC) : 0,
+                 div_s64(active, NSEC_PER_MSEC),
+                 div_s64(suspended, NSEC_PER_MSEC));
+}
+
+static DEVICE_ATTR(pm_stats, S_IRUGO, ads7870_pm_stats_show, NULL);
+
+/*
+ * Probe / Remove
+ * Powers up oscillator and reference, finds the settling time
+ * and hands the device over to runtime PM.
+ */
+int ads7870_pm_probe(struct spi_device *spi)
+{
+  int err;
+
+  /* Configure ADS7870 according to data sheet */
+  err = ads7870_spi_write_reg8(ADS7870_REFOSC, ADS7870_REFOSC_RUN);
+  if(err)
+    return err;
+
+  pm_settle_us = ref_settle_us ? ref_settle_us : ads7870_pm_measure_settle();
+  mps_info("Reference settling time %u us\n", pm_settle_us);
+
+  memset(&pm_stats, 0, sizeof(pm_stats));
+  pm_stats.since = ktime_get();
+
+  err = device_create_file(&spi->dev, &dev_attr_pm_stats);
+  if(err)
+    return err;
+
+  pm_runtime_set_active(&spi->dev);
+  pm_runtime_set_autosuspend_delay(&spi->dev, autosuspend_ms);
+  pm_runtime_use_autosuspend(&spi->dev);
+  pm_runtime_enable(&spi->dev);
+  pm_dev = &spi->dev;
+
+  return 0;
+}
+
+void ads7870_pm_remove(struct spi_device *spi)
+{
+  pm_dev = NULL;
+  pm_runtime_disable(&spi->dev);
+  pm_runtime_dont_use_autosuspend(&spi->dev);
+  pm_runtime_set_suspended(&spi->dev);
+
+  device_remove_file(&spi->dev, &dev_attr_pm_stats);
+}
@@ -0,0 +1,21 @@
+#ifndef ADS7870_PM_H
+#define ADS7870_PM_H
+#include <linux/pm.h>
+#include <linux/spi/spi.h>
+#include "ads7870.h"
+
+/* Oscillator, reference and buffer setting while converting */
+#define ADS7870_REFOSC_RUN	(ADS7870_REFOSC_OSCR |	\
+				 ADS7870_REFOSC_OSCE |	\
+				 ADS7870_REFOSC_REFE |	\
+				 ADS7870_REFOSC_BUFE |	\
+				 ADS7870_REFOSC_R2V)
+
+extern const struct dev_pm_ops ads7870_pm_ops;
+
+int ads7870_pm_get(void);
+void ads7870_pm_put(void);
+int ads7870_pm_probe(struct spi_device *spi);
+void ads7870_pm_remove(struct spi_device *spi);
+
+#endif
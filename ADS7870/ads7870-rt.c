@@ -0,0 +1,209 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/cpumask.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/version.h>
+#include <linux/module.h>
+#include "ads7870-rt.h"
+
+/*
+ * Real-time acquisition
+ *
+ * With rt_prio set, the acquisition threads (request scheduler,
+ * stream producer and snapshot sampler) run SCHED_FIFO and are
+ * pinned to acq_cpu, so conversions no longer queue behind
+ * unrelated work on a loaded system. On kernels where the SPI
+ * core runs a message pump thread for the controller, that thread
+ * is raised to the same priority; it is not pinned, since it is
+ * shared with other devices on the bus.
+ *
+ * Both parameters may be changed at run time through
+ * /sys/module/ads7870mod/parameters and apply to running threads
+ * immediately. The effect shows in the dispatch latency histogram
+ * in debugfs.
+ */
+
+#define ADS7870_RT_TASKS	4
+
+struct ads7870_rt_task {
+  struct task_struct *task;
+  bool pin;			/* Pin to acq_cpu */
+  bool rt_default;		/* SCHED_FIFO before we took it over */
+};
+
+static int rt_prio = 0;
+static int acq_cpu = -1;
+
+static DEFINE_MUTEX(rt_lock);		/* Protects rt_tasks and the parameters */
+static struct ads7870_rt_task rt_tasks[ADS7870_RT_TASKS];
+static struct task_struct *rt_pump = NULL;
+
+/* Scheduling the task had before it was attached */
+static int ads7870_rt_restore(struct ads7870_rt_task *t)
+{
+  struct sched_param param = { .sched_priority = 0 };
+
+  if(!t->rt_default)
+    return sched_setscheduler(t->task, SCHED_NORMAL, &param);
+
+  /* The priority the SPI core gives its message pump */
+  param.sched_priority = MAX_RT_PRIO - 1;
+  return sched_setscheduler(t->task, SCHED_FIFO, &param);
+}
+
+static void ads7870_rt_apply(struct ads7870_rt_task *t)
+{
+  struct sched_param param = { .sched_priority = rt_prio };
+  int err;
+
+  if(rt_prio > 0)
+    err = sched_setscheduler(t->task, SCHED_FIFO, &param);
+  else
+    err = ads7870_rt_restore(t);
+  if(err)
+    mps_err("Failed setting scheduler of %s, error %d\n", t->task->comm, err);
+
+  if(!t->pin)
+    return;
+
+  if(acq_cpu >= 0 && cpu_online(acq_cpu))
+    err = set_cpus_allowed_ptr(t->task, cpumask_of(acq_cpu));
+  else
+    err = set_cpus_allowed_ptr(t->task, cpu_all_mask);
+  if(err)
+    mps_err("Failed pinning %s to CPU %i, error %d\n", t->task->comm, acq_cpu, err);
+}
+
+static void ads7870_rt_add(struct task_struct *task, bool pin, bool rt_default)
+{
+  int i;
+
+  mutex_lock(&rt_lock);
+  for(i = 0; i < ADS7870_RT_TASKS; i++)
+    if(!rt_tasks[i].task)
+    {
+      rt_tasks[i].task = task;
+      rt_tasks[i].pin = pin;
+      rt_tasks[i].rt_default = rt_default;
+      if(rt_prio > 0 || acq_cpu >= 0)
+        ads7870_rt_apply(&rt_tasks[i]);
+      break;
+    }
+  mutex_unlock(&rt_lock);
+}
+
+/*
+ * Attach / Detach
+ * Called by the acquisition threads on themselves when they
+ * start and before they exit.
+ */
+void ads7870_rt_attach(struct task_struct *task)
+{
+  ads7870_rt_add(task, true, false);
+}
+
+void ads7870_rt_detach(struct task_struct *task)
+{
+  int i;
+
+  mutex_lock(&rt_lock);
+  for(i = 0; i < ADS7870_RT_TASKS; i++)
+    if(rt_tasks[i].task == task)
+    {
+      if(rt_prio > 0)
+        ads7870_rt_restore(&rt_tasks[i]);
+      rt_tasks[i].task = NULL;
+      break;
+    }
+  mutex_unlock(&rt_lock);
+}
+
+/*
+ * Message pump of the SPI controller
+ * The SPI core only runs one from Linux 3.4. Before that, e.g.
+ * on the 3.2 omap2_mcspi, transfers are pumped by a workqueue
+ * owned by the controller driver, which a client cannot change.
+ */
+void ads7870_rt_probe(struct spi_device *spi)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,4,0) && LINUX_VERSION_CODE < KERNEL_VERSION(5,10,0)
+  if(spi->master->queued && spi->master->kworker_task)
+  {
+    rt_pump = spi->master->kworker_task;
+    ads7870_rt_add(rt_pump, false, spi->master->rt);
+    return;
+  }
+#endif
+  mps_info("SPI controller has no message pump thread, rt_prio applies to the acquisition threads only\n");
+}
+
+void ads7870_rt_remove(struct spi_device *spi)
+{
+  if(rt_pump)
+    ads7870_rt_detach(rt_pump);
+  rt_pump = NULL;
+}
+
+static void ads7870_rt_update(void)
+{
+  int i;
+
+  for(i = 0; i < ADS7870_RT_TASKS; i++)
+    if(rt_tasks[i].task)
+      ads7870_rt_apply(&rt_tasks[i]);
+}
+
+static int ads7870_rt_set_prio(const char *val, const struct kernel_param *kp)
+{
+  int prio, err;
+
+  err = kstrtoint(val, 0, &prio);
+  if(err)
+    return err;
+  if(prio < 0 || prio >= MAX_USER_RT_PRIO)
+    return -EINVAL;
+
+  mutex_lock(&rt_lock);
+  rt_prio = prio;
+  ads7870_rt_update();
+  mutex_unlock(&rt_lock);
+
+  return 0;
+}
+
+static int ads7870_rt_set_cpu(const char *val, const struct kernel_param *kp)
+{
+  int cpu, err;
+
+  err = kstrtoint(val, 0, &cpu);
+  if(err)
+    return err;
+  if(cpu < -1 || cpu >= (int)nr_cpu_ids)
+    return -EINVAL;
+
+  mutex_lock(&rt_lock);
+  acq_cpu = cpu;
+  ads7870_rt_update();
+  mutex_unlock(&rt_lock);
+
+  return 0;
+}
+
+static struct kernel_param_ops ads7870_rt_prio_ops = {
+  .set = ads7870_rt_set_prio,
+  .get = param_get_int,
+};
+
+static struct kernel_param_ops ads7870_rt_cpu_ops = {
+  .set = ads7870_rt_set_cpu,
+  .get = param_get_int,
+};
+
+module_param_cb(rt_prio, &ads7870_rt_prio_ops, &rt_prio, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rt_prio, "SCHED_FIFO priority of the acquisition threads and SPI message pump, 0 for normal scheduling (default 0)");
+
+module_param_cb(acq_cpu, &ads7870_rt_cpu_ops, &acq_cpu, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(acq_cpu, "CPU the acquisition threads are pinned to, -1 for any (default -1)");
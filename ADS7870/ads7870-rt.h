@@ -0,0 +1,11 @@
+#ifndef ADS7870_RT_H
+#define ADS7870_RT_H
+#include <linux/sched.h>
+#include <linux/spi/spi.h>
+
+void ads7870_rt_attach(struct task_struct *task);
+void ads7870_rt_detach(struct task_struct *task);
+void ads7870_rt_probe(struct spi_device *spi);
+void ads7870_rt_remove(struct spi_device *spi);
+
+#endif
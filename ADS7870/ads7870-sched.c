@@ -0,0 +1,205 @@
+#include <linux/err.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include "ads7870-spi.h"
+#include "ads7870-sched.h"
+#include "ads7870-rt.h"
+#include "ads7870-stats.h"
+
+/*
+ * Conversion request scheduler
+ *
+ * Readers of all channels queue their conversion requests here.
+ * A single thread collects pending requests, for up to
+ * sched_window_us or until sched_batch requests are queued,
+ * and converts them in one chained SPI message. A single channel
+ * is converted polling CNVBSY, as it gains nothing from the fixed
+ * conversion delay of a batch. Requests for the same channel
+ * within a batch share one conversion. Requests
+ * arriving while a batch is on the bus are collected anyway, so
+ * the batches grow with the number of concurrent readers even
+ * with no window configured.
+ */
+
+static unsigned int sched_window_us = 0;
+module_param(sched_window_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sched_window_us, "Time to collect conversion requests before a batch is issued in microseconds (default 0)");
+
+static unsigned int sched_batch = ADS7870_BATCH_MAX;
+module_param(sched_batch, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sched_batch, "Number of queued requests that issues a batch immediately (default 16)");
+
+struct ads7870_req {
+  struct list_head node;
+  u8 channel;
+  s16 value;
+  int status;
+  s64 queued_ns;
+  struct completion done;
+};
+
+static LIST_HEAD(sched_queue);
+static DEFINE_SPINLOCK(sched_lock);	/* Protects sched_queue and sched_pending */
+static unsigned int sched_pending = 0;
+static struct task_struct *sched_task = NULL;
+
+static unsigned int ads7870_sched_batch_size(void)
+{
+  unsigned int batch = sched_batch;
+
+  if(batch == 0 || batch > ADS7870_BATCH_MAX)
+    batch = ADS7870_BATCH_MAX;
+  return batch;
+}
+
+/*
+ * Take up to one batch of requests off the queue
+ */
+static int ads7870_sched_collect(struct list_head *batch)
+{
+  struct ads7870_req *req, *tmp;
+  unsigned int max = ads7870_sched_batch_size();
+  int n = 0;
+
+  spin_lock(&sched_lock);
+  list_for_each_entry_safe(req, tmp, &sched_queue, node)
+  {
+    if(n == max)
+      break;
+    list_move_tail(&req->node, batch);
+    n++;
+  }
+  sched_pending -= n;
+  spin_unlock(&sched_lock);
+
+  return n;
+}
+
+static void ads7870_sched_run(struct list_head *batch)
+{
+  u8 channels[ADS7870_BATCH_MAX];
+  s16 values[ADS7870_BATCH_MAX];
+  struct ads7870_req *req, *tmp;
+  s64 now_ns = ktime_to_ns(ktime_get());
+  int i, n = 0, err;
+
+  /* One conversion per distinct channel */
+  list_for_each_entry(req, batch, node)
+  {
+    ads7870_stats_dispatch(now_ns - req->queued_ns);
+    for(i = 0; i < n; i++)
+      if(channels[i] == req->channel)
+        break;
+    if(i == n)
+      channels[n++] = req->channel;
+  }
+
+  if(n == 1)
+    err = ads7870_convert(channels[0], &values[0]);
+  else
+    err = ads7870_convert_batch(channels, values, n);
+
+  list_for_each_entry_safe(req, tmp, batch, node)
+  {
+    for(i = 0; i < n; i++)
+      if(channels[i] == req->channel)
+        break;
+    req->value = values[i];
+    req->status = err;
+    list_del(&req->node);
+    complete(&req->done);
+  }
+}
+
+static int ads7870_sched_thread(void *data)
+{
+  LIST_HEAD(batch);
+  ktime_t expires;
+
+  ads7870_rt_attach(current);
+
+  while(!kthread_should_stop())
+  {
+    /* Sleep until requests are queued */
+    set_current_state(TASK_INTERRUPTIBLE);
+    if(!sched_pending && !kthread_should_stop())
+    {
+      schedule();
+      continue;
+    }
+    __set_current_state(TASK_RUNNING);
+
+    /* Collection window, cut short when the batch is full */
+    if(sched_window_us && sched_pending < ads7870_sched_batch_size())
+    {
+      expires = ktime_add_ns(ktime_get(), (u64)sched_window_us * NSEC_PER_USEC);
+      set_current_state(TASK_INTERRUPTIBLE);
+      if(sched_pending < ads7870_sched_batch_size())
+        schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+      __set_current_state(TASK_RUNNING);
+    }
+
+    while(ads7870_sched_collect(&batch))
+      ads7870_sched_run(&batch);
+  }
+
+  ads7870_rt_detach(current);
+  return 0;
+}
+
+/*
+ * Queue a conversion and wait for its batch to complete
+ */
+int ads7870_sched_convert(u8 channel, s16* value)
+{
+  struct ads7870_req req;
+  unsigned int pending;
+
+  if(!sched_task)
+    return -ENODEV;
+
+  req.channel = channel & 0x07;
+  req.status = 0;
+  req.queued_ns = ktime_to_ns(ktime_get());
+  init_completion(&req.done);
+
+  spin_lock(&sched_lock);
+  list_add_tail(&req.node, &sched_queue);
+  pending = ++sched_pending;
+  spin_unlock(&sched_lock);
+
+  /* Wake on the first request, and when a batch is full */
+  if(pending == 1 || pending >= ads7870_sched_batch_size())
+    wake_up_process(sched_task);
+
+  /* The request lives on our stack, so the wait cannot be interrupted */
+  wait_for_completion(&req.done);
+
+  *value = req.value;
+  return req.status;
+}
+
+int ads7870_sched_init(void)
+{
+  sched_task = kthread_run(ads7870_sched_thread, NULL, "ads7870-sched");
+  if(IS_ERR(sched_task))
+  {
+    int err = PTR_ERR(sched_task);
+    sched_task = NULL;
+    return err;
+  }
+
+  return 0;
+}
+
+void ads7870_sched_exit(void)
+{
+  if(sched_task)
+    kthread_stop(sched_task);
+  sched_task = NULL;
+}
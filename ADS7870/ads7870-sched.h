@@ -0,0 +1,9 @@
+#ifndef ADS7870_SCHED_H
+#define ADS7870_SCHED_H
+#include <linux/types.h>
+
+int ads7870_sched_convert(u8 channel, s16* value);
+int ads7870_sched_init(void);
+void ads7870_sched_exit(void);
+
+#endif
@@ -0,0 +1,199 @@
+#include <linux/err.h>
+#include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <asm/uaccess.h>
+#include <linux/module.h>
+#include "ads7870-spi.h"
+#include "ads7870-snap.h"
+#include "ads7870-cache.h"
+#include "ads7870-rt.h"
+#include "ads7870-uapi.h"
+
+/*
+ * Latest-value snapshot page
+ *
+ * While /dev/adcsnap is open (or mapped) a kernel thread converts
+ * the enabled channels periodically and publishes the results in
+ * a single page. Readers mmap the page read-only and use the
+ * sequence counter in the page header to take consistent copies,
+ * so they get the latest values without syscalls or SPI traffic.
+ */
+
+static unsigned int snap_period_us = 1000;
+module_param(snap_period_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(snap_period_us, "Snapshot sampler period in microseconds (default 1000)");
+
+static unsigned int snap_channels = 0xff;
+module_param(snap_channels, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(snap_channels, "Bitmask of channels sampled into the snapshot page (default 0xff)");
+
+static struct ads7870_snap_page *snap_page = NULL;
+static DEFINE_SPINLOCK(snap_lock);	/* Serializes writers of snap_page */
+
+static DEFINE_MUTEX(snap_users_lock);
+static int snap_users = 0;
+static struct task_struct *snap_task = NULL;
+
+/*
+ * Publish a conversion result in the snapshot page
+ * May be called from any context converting a channel,
+ * not only the sampler thread.
+ */
+void ads7870_snap_publish(u8 channel, s16 value, int status, ktime_t stamp)
+{
+  struct ads7870_snap_channel *ch;
+  unsigned long flags;
+
+  if(!snap_page || channel >= ADS7870_NBR_CHANNELS)
+    return;
+
+  ch = &snap_page->ch[channel];
+
+  spin_lock_irqsave(&snap_lock, flags);
+  snap_page->seq++;
+  smp_wmb();
+
+  ch->timestamp_ns = ktime_to_ns(stamp);
+  ch->status = status;
+  if(!status)
+  {
+    ch->value = value;
+    ch->sequence++;
+  }
+
+  smp_wmb();
+  snap_page->seq++;
+  spin_unlock_irqrestore(&snap_lock, flags);
+}
+
+static int ads7870_snap_thread(void *data)
+{
+  u8 channels[ADS7870_NBR_CHANNELS];
+  s16 values[ADS7870_NBR_CHANNELS];
+  unsigned int period;
+  s64 start_ns;
+  ktime_t stamp;
+  int ch, n, i, err;
+
+  ads7870_rt_attach(current);
+
+  while(!kthread_should_stop())
+  {
+    /* Scan all enabled channels in one batch */
+    for(ch = 0, n = 0; ch < ADS7870_NBR_CHANNELS; ch++)
+      if(snap_channels & (1 << ch))
+        channels[n++] = ch;
+
+    if(n)
+    {
+      start_ns = ktime_to_ns(ktime_get());
+      err = ads7870_convert_batch(channels, values, n);
+      stamp = ktime_get();
+
+      for(i = 0; i < n; i++)
+      {
+        if(!err)
+          ads7870_cache_update(channels[i], values[i], start_ns);
+        ads7870_snap_publish(channels[i], values[i], err, stamp);
+      }
+    }
+
+    period = snap_period_us ? snap_period_us : 1;
+    snap_page->period_us = period;
+    usleep_range(period, period + period / 8 + 1);
+  }
+
+  ads7870_rt_detach(current);
+  return 0;
+}
+
+/*
+ * Open / Release
+ * The sampler runs for as long as somebody holds the snapshot
+ * device open. A mapping keeps the file open, so mapped readers
+ * keep the page updated after closing their descriptor.
+ */
+int ads7870_snap_open(void)
+{
+  int err = 0;
+
+  mutex_lock(&snap_users_lock);
+  if(snap_users++ == 0)
+  {
+    snap_task = kthread_run(ads7870_snap_thread, NULL, "ads7870-snap");
+    if(IS_ERR(snap_task))
+    {
+      err = PTR_ERR(snap_task);
+      snap_task = NULL;
+      snap_users--;
+    }
+  }
+  mutex_unlock(&snap_users_lock);
+
+  return err;
+}
+
+void ads7870_snap_release(void)
+{
+  mutex_lock(&snap_users_lock);
+  if(--snap_users == 0 && snap_task)
+  {
+    kthread_stop(snap_task);
+    snap_task = NULL;
+  }
+  mutex_unlock(&snap_users_lock);
+}
+
+int ads7870_snap_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+  if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE)
+    return -EINVAL;
+
+  /* The page is strictly read-only for user space */
+  if(vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  vma->vm_flags &= ~VM_MAYWRITE;
+
+  return vm_insert_page(vma, vma->vm_start, virt_to_page(snap_page));
+}
+
+/*
+ * Copy of the snapshot page for read(), for users that
+ * do not want to map it. Reads continue from f_pos and end
+ * with the page; seek back to 0 for a fresh snapshot.
+ */
+ssize_t ads7870_snap_copy(char __user *ubuf, size_t count, loff_t *f_pos)
+{
+  struct ads7870_snap_page copy;
+  unsigned long flags;
+
+  spin_lock_irqsave(&snap_lock, flags);
+  copy = *snap_page;
+  spin_unlock_irqrestore(&snap_lock, flags);
+
+  return simple_read_from_buffer(ubuf, count, f_pos, &copy, sizeof(copy));
+}
+
+int ads7870_snap_init(void)
+{
+  BUILD_BUG_ON(sizeof(struct ads7870_snap_page) > PAGE_SIZE);
+
+  snap_page = (struct ads7870_snap_page *)get_zeroed_page(GFP_KERNEL);
+  if(!snap_page)
+    return -ENOMEM;
+
+  snap_page->magic = ADS7870_SNAP_MAGIC;
+  snap_page->nbr_channels = ADS7870_NBR_CHANNELS;
+  snap_page->period_us = snap_period_us;
+
+  return 0;
+}
+
+void ads7870_snap_exit(void)
+{
+  free_page((unsigned long)snap_page);
+  snap_page = NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef ADS7870_SNAP_H
+#define ADS7870_SNAP_H
+#include <linux/fs.h>
+#include <linux/ktime.h>
+
+int ads7870_snap_open(void);
+void ads7870_snap_release(void);
+int ads7870_snap_mmap(struct file *filep, struct vm_area_struct *vma);
+ssize_t ads7870_snap_copy(char __user *ubuf, size_t count, loff_t *f_pos);
+void ads7870_snap_publish(u8 channel, s16 value, int status, ktime_t stamp);
+int ads7870_snap_init(void);
+void ads7870_snap_exit(void);
+
+#endif
@@ -1,15 +1,76 @@
+#include "mps-log.h"
 #include <linux/err.h>
 #include <plat/mcspi.h>
 #include <asm/uaccess.h>
 #include <linux/interrupt.h>
 #include <linux/input.h>
+#include <linux/ktime.h>
 #include <linux/spi/spi.h>
 #include "ads7870.h"
+#include "ads7870-spi.h"
+#include "ads7870-pm.h"
+#include "ads7870-rt.h"
+#include "ads7870-tune.h"
+#include "ads7870-stats.h"
+#include "mps-spi-arb.h"
+
+#define CREATE_TRACE_POINTS
+#include "ads7870-trace.h"
 #include <linux/module.h>
-
-#define MODULE_DEBUG 0
+#include <linux/mutex.h>
+#include <linux/slab.h>
 
 static struct spi_device *ads7870_spi_device = NULL;
+static DEFINE_MUTEX(ads7870_conv_lock);
+
+/*
+ * A conversion takes about 5 us with the 2.5 MHz conversion
+ * clock ads7870-pm selects, at the 1x gain the batch uses.
+ * Batched messages never read back sooner than this.
+ */
+#define ADS7870_CONV_MIN_US	8
+
+static unsigned int conv_delay_us = 10;
+module_param(conv_delay_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(conv_delay_us, "Time allowed for a conversion in batched messages in microseconds, at least 8 (default 10)");
+
+/*
+ * Buffers for batched conversions
+ * Allocated once, as transfer buffers must be DMA safe,
+ * and protected by ads7870_conv_lock.
+ */
+struct ads7870_batch {
+  struct spi_transfer t[ADS7870_BATCH_MAX * 3];
+  u8 tx[ADS7870_BATCH_MAX][2];		/* GAINMUX write: cmd, data */
+  u8 rd[ADS7870_BATCH_MAX];		/* RESULT read cmd */
+  u8 rx[ADS7870_BATCH_MAX][2] ____cacheline_aligned;
+};
+
+static struct ads7870_batch *ads7870_batch = NULL;
+
+static int arb_prio = 0;
+module_param(arb_prio, int, S_IRUGO);
+MODULE_PARM_DESC(arb_prio, "SPI bus arbitration priority against other devices on the bus, higher goes first (default 0)");
+
+static struct mps_arb_client ads7870_arb = {
+  .name = "ads7870",
+};
+
+/*
+ * All messages to the ADS7870 go through the bus arbiter,
+ * one message at a time, so a DAC update waits for at most
+ * one ADC transaction.
+ */
+static int ads7870_spi_sync(struct spi_message *m)
+{
+  int err;
+
+  mps_arb_acquire(&ads7870_arb);
+  err = spi_sync(m->spi, m);
+  mps_arb_release(&ads7870_arb);
+
+  return err;
+}
 
 int ads7870_spi_read_reg8(u8 addr, u8* value)
 {
@@ -17,6 +78,7 @@ int ads7870_spi_read_reg8(u8 addr, u8* value)
 	struct spi_message m;
 	u8 cmd;
 	u8 data = 0;
+	int err;
 
     /* Check for valid spi device */
     if(!ads7870_spi_device)
@@ -46,13 +108,14 @@ int ads7870_spi_read_reg8(u8 addr, u8* value)
 	spi_message_add_tail(&t[1], &m);
 
 	/* Transmit SPI Data (blocking) */
-	spi_sync(m.spi, &m);
+	err = ads7870_spi_sync(&m);
+	trace_ads7870_reg_read(addr, data, 8, err);
+	ads7870_stats_xfer(2, err);
 
-	if(MODULE_DEBUG)
-	  printk(KERN_DEBUG "ADS7870: Read Reg8 Addr 0x%02x Data: 0x%02x\n", cmd, data);
+	mps_dbg("Read Reg8 Addr 0x%02x Data: 0x%02x\n", cmd, data);
 
     *value = data;
-	return 0;
+	return err;
 }
 
 int ads7870_spi_read_reg16(u8 addr, u16* value)
@@ -61,6 +124,7 @@ int ads7870_spi_read_reg16(u8 addr, u16* value)
 	struct spi_message m;
 	u8 cmd;
 	u16 data = 0;
+	int err;
 
     /* Check for valid spi device */
     if(!ads7870_spi_device)
@@ -82,8 +146,6 @@ int ads7870_spi_read_reg16(u8 addr, u16* value)
 	t[0].tx_buf = &cmd;
 	t[0].rx_buf = NULL;
 	t[0].len = 1;
-	if(MODULE_DEBUG)
-	  printk("requesting data from addr 0x%x\n", cmd);
 	spi_message_add_tail(&t[0], &m);
 
 	t[1].tx_buf = NULL;
@@ -92,13 +154,14 @@ int ads7870_spi_read_reg16(u8 addr, u16* value)
 	spi_message_add_tail(&t[1], &m);
 
 	/* Transmit SPI Data (blocking) */
-	spi_sync(m.spi, &m);
+	err = ads7870_spi_sync(&m);
+	trace_ads7870_reg_read(addr, data, 16, err);
+	ads7870_stats_xfer(3, err);
 
-	if(MODULE_DEBUG)
-	  printk(KERN_DEBUG "ADS7870: Read Reg16 Addr 0x%02x Data: 0x%04x\n", cmd, data);
+	mps_dbg("Read Reg16 Addr 0x%02x Data: 0x%04x\n", cmd, data);
 
     *value = data;
-	return 0;
+	return err;
 }
 
 
@@ -107,6 +170,7 @@ int ads7870_spi_write_reg8(u8 addr, u8 data)
   struct spi_transfer t[2];
   struct spi_message m;
   u8 cmd;
+  int err;
 
   /* Check for valid spi device */
   if(!ads7870_spi_device)
@@ -125,8 +189,7 @@ int ads7870_spi_write_reg8(u8 addr, u8 data)
   spi_message_init(&m);
   m.spi = ads7870_spi_device;
 
-  if(MODULE_DEBUG)
-    printk(KERN_DEBUG "ADS7870: Write Reg8 Addr 0x%x Data 0x%02x\n", addr, data); 
+  mps_dbg("Write Reg8 Addr 0x%x Data 0x%02x\n", addr, data);
 
   /* Configure tx/rx buffers */
   t[0].tx_buf = &cmd;
@@ -140,9 +203,194 @@ int ads7870_spi_write_reg8(u8 addr, u8 data)
   spi_message_add_tail(&t[1], &m);
 
   /* Transmit SPI Data (blocking) */
-  spi_sync(m.spi, &m);
+  err = ads7870_spi_sync(&m);
+  trace_ads7870_reg_write(addr, data, err);
+  ads7870_stats_xfer(2, err);
 
-  return 0;
+  return err;
+}
+
+/*
+ * Hold off conversions, e.g. while the bus is reconfigured.
+ * Register access is not blocked.
+ */
+void ads7870_spi_lock(void)
+{
+  mutex_lock(&ads7870_conv_lock);
+}
+
+void ads7870_spi_unlock(void)
+{
+  mutex_unlock(&ads7870_conv_lock);
+}
+
+/* Device of the probed ADS7870, for registering sub-devices */
+struct device *ads7870_spi_dev(void)
+{
+  return ads7870_spi_device ? &ads7870_spi_device->dev : NULL;
+}
+
+/*
+ * Single channel conversion
+ * Starts a conversion, polls until it has completed and reads
+ * back the result. The whole sequence is serialized, as several
+ * contexts (readers, the snapshot sampler) may convert at once.
+ */
+int ads7870_convert(u8 channel, s16* value)
+{
+  unsigned int polls = 0;
+  s64 duration_ns = 0;
+  ktime_t start;
+  bool timed;
+  u8 status;
+  int err;
+
+  err = ads7870_pm_get();
+  if(err)
+    return err;
+
+  mutex_lock(&ads7870_conv_lock);
+
+  /* Only time the conversion for somebody using the duration */
+  timed = mps_trace_enabled(ads7870_conv_end) || mps_stats_latency;
+  if(timed)
+    start = ktime_get();
+  trace_ads7870_conv_start(channel);
+
+  /* Start Conversion */
+  err = ads7870_spi_write_reg8(ADS7870_GAINMUX, 
+                               ADS7870_GAIN_1X | 
+                               ADS7870_CH_SINGLE_ENDED |
+                               (channel & 0x07)| 
+                               ADS7870_CONVERT);
+  if(err)
+    goto out;
+  
+  /* poll ADS7870 until conversion is ready */
+  do
+  {
+    err = ads7870_spi_read_reg8(ADS7870_GAINMUX, &status);
+    trace_ads7870_conv_poll(channel, ++polls, status);
+  }
+  while((!err) && ( (status & ADS7870_CONVERT) > 0));
+  if(err)
+    goto out;
+
+  /* Read Result - Register wise its handled via u16, however we want it in s16. */
+  err = ads7870_spi_read_reg16(ADS7870_RESULTLO, (u16*)value);
+  if(*value & ADS7870_RESULTLO_OVR)
+    mps_warn_ratelimited("Error! PGA Out of Range\n");
+  *value = *value >> 4; // right-align result, lower 4-bits are zero
+
+  mps_dbg("Channel %i result: %i mV\n", channel, *value);
+
+ out:
+  if(timed)
+    duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+  trace_ads7870_conv_end(channel, err ? 0 : *value, polls, duration_ns, err);
+  if(!err)
+    ads7870_stats_conv(1, polls, duration_ns);
+  mutex_unlock(&ads7870_conv_lock);
+  ads7870_pm_put();
+  return err;
+}
+
+/*
+ * Batched conversion
+ * Converts a list of channels in a single SPI message. Instead of
+ * polling CNVBSY, each conversion is given conv_delay_us with chip
+ * select released before its result is read back, so the whole
+ * batch costs one spi_sync. A delay shorter than the conversion
+ * would read the previous result, so it is raised to
+ * ADS7870_CONV_MIN_US.
+ */
+int ads7870_convert_batch(const u8* channels, s16* values, int n)
+{
+  struct ads7870_batch *b = ads7870_batch;
+  struct spi_transfer *t;
+  struct spi_message m;
+  unsigned int delay_us = max_t(unsigned int, conv_delay_us, ADS7870_CONV_MIN_US);
+  ktime_t start;
+  s64 duration_ns = 0;
+  bool timed;
+  u16 raw;
+  int i, err;
+
+  /* Check for valid spi device */
+  if(!ads7870_spi_device || !b)
+    return -ENODEV;
+
+  if(n <= 0 || n > ADS7870_BATCH_MAX)
+    return -EINVAL;
+
+  err = ads7870_pm_get();
+  if(err)
+    return err;
+
+  mutex_lock(&ads7870_conv_lock);
+
+  /* Init Message */
+  memset(b->t, 0, sizeof(b->t));
+  spi_message_init(&m);
+  m.spi = ads7870_spi_device;
+
+  for(i = 0; i < n; i++)
+  {
+    t = &b->t[i * 3];
+
+    /* Start conversion, then leave the ADS7870 to convert */
+    b->tx[i][0] = ADS7870_REG_WRITE | (ADS7870_GAINMUX & 0x1f);
+    b->tx[i][1] = ADS7870_GAIN_1X | 
+                  ADS7870_CH_SINGLE_ENDED |
+                  (channels[i] & 0x07) |
+                  ADS7870_CONVERT;
+    t[0].tx_buf = b->tx[i];
+    t[0].len = 2;
+    t[0].delay_usecs = delay_us;
+    t[0].cs_change = 1;
+    spi_message_add_tail(&t[0], &m);
+
+    /* Read back the 16 bit result */
+    b->rd[i] = ADS7870_REG_READ | ADS7870_REG_16BIT | (ADS7870_RESULTLO & 0x1f);
+    t[1].tx_buf = &b->rd[i];
+    t[1].len = 1;
+    spi_message_add_tail(&t[1], &m);
+
+    t[2].rx_buf = b->rx[i];
+    t[2].len = 2;
+    t[2].cs_change = (i < n - 1);
+    spi_message_add_tail(&t[2], &m);
+  }
+
+  /* Transmit SPI Data (blocking) */
+  timed = mps_trace_enabled(ads7870_batch) || mps_trace_enabled(ads7870_conv_end) ||
+          mps_stats_latency;
+  if(timed)
+    start = ktime_get();
+  for(i = 0; i < n; i++)
+    trace_ads7870_conv_start(channels[i]);
+  err = ads7870_spi_sync(&m);
+  if(!err)
+    err = m.status;
+  if(timed)
+    duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+  trace_ads7870_batch(n, duration_ns, err);
+  ads7870_stats_xfer(n * 5, err);
+  if(!err)
+    ads7870_stats_conv(n, 0, duration_ns);
+
+  for(i = 0; !err && i < n; i++)
+  {
+    raw = b->rx[i][0] | (b->rx[i][1] << 8);
+    if(raw & ADS7870_RESULTLO_OVR)
+      mps_warn_ratelimited("Error! PGA Out of Range\n");
+    values[i] = ((s16)raw) >> 4; // right-align result, lower 4-bits are zero
+    trace_ads7870_conv_end(channels[i], values[i], 0, duration_ns, 0);
+  }
+
+  mutex_unlock(&ads7870_conv_lock);
+  ads7870_pm_put();
+  return err;
 }
 
 /*
@@ -159,22 +407,52 @@ static int __devinit ads7870_spi_probe(struct spi_device *spi)
   spi->bits_per_word = 8;  
   spi_setup(spi);
 
+  ads7870_arb.prio = arb_prio;
+  err = mps_arb_register(&ads7870_arb, spi);
+  if(err)
+    return err;
+
   /* In this case we assume just one device */ 
   ads7870_spi_device = spi;  
 
   
   err = ads7870_spi_read_reg8(ADS7870_ID, &value);
-  printk(KERN_DEBUG "Probing ADS7870, ADS7870 Revision %i\n", 
+  mps_info("Probing ADS7870, ADS7870 Revision %i\n", 
          value);
+  if(err)
+    goto err_arb;
 
-  
+  ads7870_rt_probe(spi);
+
+  /* Power up, and hand over to runtime PM */
+  err = ads7870_pm_probe(spi);
+  if(err)
+    goto err_rt;
+
+  err = ads7870_tune_probe(spi);
+  if(err)
+    goto err_pm;
+
+  return 0;
+
+err_pm:
+  ads7870_pm_remove(spi);
+err_rt:
+  ads7870_rt_remove(spi);
+err_arb:
+  mps_arb_unregister(&ads7870_arb);
+  ads7870_spi_device = NULL;
   return err;
 }
 
 static int __devexit ads7870_remove(struct spi_device *spi)
 {
-  printk (KERN_ALERT "ads7870 SPI driver has been removed while in use\n");
+  mps_info("ads7870 SPI driver has been removed while in use\n");
   
+  ads7870_tune_remove(spi);
+  ads7870_pm_remove(spi);
+  ads7870_rt_remove(spi);
+  mps_arb_unregister(&ads7870_arb);
   ads7870_spi_device = 0;
   return 0;
 }
@@ -184,6 +462,7 @@ static struct spi_driver ads7870_spi_driver = {
     .name = "ads7870",
     .bus = &spi_bus_type,
     .owner = THIS_MODULE,
+    .pm = &ads7870_pm_ops,
   },
   .probe = ads7870_spi_probe,
   .remove = __devexit_p(ads7870_remove),
@@ -202,10 +481,14 @@ int ads7870_spi_init(void)
   
   int err;
 
+  ads7870_batch = kzalloc(sizeof(*ads7870_batch), GFP_KERNEL);
+  if(!ads7870_batch)
+    return -ENOMEM;
+
   err = spi_register_driver(&ads7870_spi_driver);
   
   if(err<0)
-    printk (KERN_ALERT "Error %d registering the ads7870 SPI driver\n", err);
+    mps_err("Error %d registering the ads7870 SPI driver\n", err);
   
   /* 
    * Probe should have been called if a device is available 
@@ -217,6 +500,12 @@ int ads7870_spi_init(void)
     spi_unregister_driver(&ads7870_spi_driver); 
     err = -ENODEV;
   }
+
+  if(err)
+  {
+    kfree(ads7870_batch);
+    ads7870_batch = NULL;
+  }
   
   return err;
 }
@@ -229,6 +518,9 @@ int ads7870_spi_exit(void)
    */
   spi_unregister_driver(&ads7870_spi_driver); 
 
+  kfree(ads7870_batch);
+  ads7870_batch = NULL;
+
   return 0;
 }
 
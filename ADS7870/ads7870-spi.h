@@ -3,9 +3,16 @@
 #include <linux/spi/spi.h>
 #include <linux/input.h>
 
+#define ADS7870_BATCH_MAX	16
+
 int ads7870_spi_read_reg8(u8 addr, u8* value);
 int ads7870_spi_read_reg16(u8 addr, u16* value);
 int ads7870_spi_write_reg8(u8 addr, u8 data);
+int ads7870_convert(u8 channel, s16* value);
+int ads7870_convert_batch(const u8* channels, s16* values, int n);
+void ads7870_spi_lock(void);
+void ads7870_spi_unlock(void);
+struct device *ads7870_spi_dev(void);
 int ads7870_spi_init(void);
 int ads7870_spi_exit(void);
 
@@ -0,0 +1,70 @@
+#include <linux/math64.h>
+#include <linux/module.h>
+#include "ads7870-stats.h"
+
+/*
+ * debugfs statistics, in /sys/kernel/debug/ads7870/
+ * Bus and conversion counters, see mps-stats.h.
+ */
+
+DEFINE_PER_CPU(struct ads7870_stats, ads7870_stats);
+
+void ads7870_stats_xfer(unsigned int bytes, int err)
+{
+  ads7870_stats_inc(transactions);
+  ads7870_stats_add(bytes, bytes);
+  if(err)
+    ads7870_stats_inc(spi_errors);
+}
+
+void ads7870_stats_conv(unsigned int n, unsigned int polls, s64 duration_ns)
+{
+  ads7870_stats_add(conversions, n);
+  ads7870_stats_add(polls, polls);
+  if(mps_stats_latency)
+    ads7870_stats_add(latency[mps_stats_bucket(duration_ns)], n);
+}
+
+void ads7870_stats_dispatch(s64 delay_ns)
+{
+  ads7870_stats_inc(dispatch[mps_stats_bucket(delay_ns)]);
+}
+
+static void ads7870_stats_show(struct seq_file *m, const void *data)
+{
+  const struct ads7870_stats *sum = data;
+
+  seq_printf(m, "transactions %llu\n", sum->transactions);
+  seq_printf(m, "bytes %llu\n", sum->bytes);
+  seq_printf(m, "spi_errors %llu\n", sum->spi_errors);
+  seq_printf(m, "reads %llu\n", sum->reads);
+  seq_printf(m, "cache_hits %llu\n", sum->cache_hits);
+  seq_printf(m, "conversions %llu\n", sum->conversions);
+  seq_printf(m, "polls %llu\n", sum->polls);
+
+  /* Ratios in hundredths */
+  seq_printf(m, "transactions_per_read %llu\n",
+             sum->reads ? div64_u64(sum->transactions * 100, sum->reads) : 0);
+  seq_printf(m, "polls_per_conversion %llu\n",
+             sum->conversions ? div64_u64(sum->polls * 100, sum->conversions) : 0);
+
+  mps_stats_hist_show(m, "latency_us", sum->latency);
+  mps_stats_hist_show(m, "dispatch_us", sum->dispatch);
+}
+
+static struct mps_stats ads7870_debugfs = {
+  .name     = "ads7870",
+  .counters = &ads7870_stats,
+  .size     = sizeof(struct ads7870_stats),
+  .show     = ads7870_stats_show,
+};
+
+void ads7870_stats_init(void)
+{
+  mps_stats_register(&ads7870_debugfs);
+}
+
+void ads7870_stats_exit(void)
+{
+  mps_stats_unregister(&ads7870_debugfs);
+}
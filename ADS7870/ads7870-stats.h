@@ -0,0 +1,32 @@
+#ifndef ADS7870_STATS_H
+#define ADS7870_STATS_H
+#include "mps-stats.h"
+
+/*
+ * Per-CPU counters, summed when read through debugfs
+ */
+struct ads7870_stats {
+  u64 transactions;		/* spi_sync calls */
+  u64 bytes;			/* Bytes clocked on the bus */
+  u64 spi_errors;		/* Failed spi_sync calls */
+  u64 reads;			/* One-shot read() calls */
+  u64 cache_hits;		/* read() served from the cache */
+  u64 conversions;
+  u64 polls;			/* CNVBSY polls of single conversions */
+  u64 latency[MPS_STATS_BUCKETS]; /* Conversion latency */
+  u64 dispatch[MPS_STATS_BUCKETS]; /* Request queued or scan due until
+                                      the acquisition thread ran */
+};
+
+DECLARE_PER_CPU(struct ads7870_stats, ads7870_stats);
+
+#define ads7870_stats_inc(field)	mps_stats_inc(ads7870_stats, field)
+#define ads7870_stats_add(field, n)	mps_stats_add(ads7870_stats, field, n)
+
+void ads7870_stats_xfer(unsigned int bytes, int err);
+void ads7870_stats_conv(unsigned int n, unsigned int polls, s64 duration_ns);
+void ads7870_stats_dispatch(s64 delay_ns);
+void ads7870_stats_init(void);
+void ads7870_stats_exit(void);
+
+#endif
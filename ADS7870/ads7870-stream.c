@@ -0,0 +1,735 @@
+#include <linux/err.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/splice.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <asm/uaccess.h>
+#include <linux/module.h>
+#include "ads7870-spi.h"
+#include "ads7870-snap.h"
+#include "ads7870-cache.h"
+#include "ads7870-stream.h"
+#include "ads7870-rt.h"
+#include "ads7870-stats.h"
+
+/*
+ * Broadcast stream
+ *
+ * A single producer thread runs while /dev/adcstream is open and
+ * appends one frame per scan to a shared ring. Each open file
+ * keeps its own cursor into the ring, so any number of readers
+ * see the full-rate stream for the cost of one acquisition. The
+ * producer never waits for readers: a reader that has fallen a
+ * whole ring behind is moved forward and the skipped frames are
+ * counted as overruns for that file.
+ */
+
+static unsigned int stream_period_us = 1000;
+module_param(stream_period_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(stream_period_us, "Stream scan period in microseconds, 0 for triggered scans only (default 1000)");
+
+static unsigned int stream_channels = 0xff;
+module_param(stream_channels, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(stream_channels, "Bitmask of channels in each stream frame (default 0xff)");
+
+static unsigned int stream_frames = 1024;
+module_param(stream_frames, uint, S_IRUGO);
+MODULE_PARM_DESC(stream_frames, "Number of frames in the stream ring, rounded up to a power of two (default 1024)");
+
+struct ads7870_stream_reader {
+  struct mutex lock;		/* Serializes read() and ioctl() on the file */
+  u64 cursor;			/* Next frame to be read */
+  u64 overruns;			/* Frames lost by this reader */
+  u32 layout;			/* ADS7870_LAYOUT_* */
+  u32 block_len;		/* Frames per planar block */
+  struct ads7870_frame *bounce;	/* Frames copied out of the ring */
+  size_t bounce_frames;
+  void *block;			/* One planar block being written out */
+};
+
+#define STREAM_BOUNCE_FRAMES	(PAGE_SIZE / sizeof(struct ads7870_frame))
+
+static struct ads7870_frame *ring = NULL;
+static unsigned int ring_mask;
+static u64 ring_head = 0;		/* Sequence number of the next frame */
+static DEFINE_SPINLOCK(ring_lock);	/* Protects ring and ring_head */
+static DECLARE_WAIT_QUEUE_HEAD(ring_wait);
+
+static DEFINE_MUTEX(stream_users_lock);
+static int stream_users = 0;
+static struct task_struct *stream_task = NULL;
+
+/*
+ * Append a frame to the ring and wake up readers
+ * The sequence number is assigned here.
+ */
+void ads7870_stream_push(const struct ads7870_frame *frame)
+{
+  struct ads7870_frame *slot;
+  unsigned long flags;
+
+  spin_lock_irqsave(&ring_lock, flags);
+  slot = &ring[ring_head & ring_mask];
+  *slot = *frame;
+  slot->sequence = ring_head++;
+  spin_unlock_irqrestore(&ring_lock, flags);
+
+  wake_up_interruptible(&ring_wait);
+}
+
+/*
+ * Convert the channels in mask and push the result as one frame
+ * Used by the producer thread and by the trigger interrupt.
+ */
+void ads7870_stream_scan(unsigned int mask, s64 stamp_ns, u32 flags)
+{
+  u8 channels[ADS7870_NBR_CHANNELS];
+  s16 values[ADS7870_NBR_CHANNELS];
+  struct ads7870_frame frame;
+  s64 start_ns;
+  int ch, n, i, err;
+
+  mask &= (1 << ADS7870_NBR_CHANNELS) - 1;
+  for(ch = 0, n = 0; ch < ADS7870_NBR_CHANNELS; ch++)
+    if(mask & (1 << ch))
+      channels[n++] = ch;
+
+  if(!n)
+    return;
+
+  memset(&frame, 0, sizeof(frame));
+  start_ns = ktime_to_ns(ktime_get());
+  err = ads7870_convert_batch(channels, values, n);
+
+  frame.timestamp_ns = stamp_ns ? stamp_ns : start_ns;
+  frame.status = err;
+  frame.flags = flags;
+  frame.channel_mask = err ? 0 : mask;
+  for(i = 0; !err && i < n; i++)
+  {
+    frame.value[channels[i]] = values[i];
+    ads7870_cache_update(channels[i], values[i], start_ns);
+  }
+  ads7870_stream_push(&frame);
+}
+
+/*
+ * Producer thread
+ * A period of 0 disables periodic scans, leaving the ring
+ * to frames started by the trigger input. Scans are due on
+ * absolute deadlines, so the period does not drift with the
+ * scan time; a scan that is more than a period late is not
+ * caught up on.
+ */
+static int ads7870_stream_thread(void *data)
+{
+  unsigned int period;
+  ktime_t due, now;
+
+  ads7870_rt_attach(current);
+  due = ktime_get();
+
+  while(!kthread_should_stop())
+  {
+    period = stream_period_us;
+    if(!period)
+    {
+      schedule_timeout_interruptible(HZ / 10);
+      due = ktime_get();
+      continue;
+    }
+
+    now = ktime_get();
+    ads7870_stats_dispatch(ktime_to_ns(ktime_sub(now, due)));
+    ads7870_stream_scan(stream_channels, 0, 0);
+
+    due = ktime_add_us(due, period);
+    if(ktime_to_ns(ktime_sub(due, now)) <= 0)
+      due = ktime_add_us(now, period);
+
+    set_current_state(TASK_INTERRUPTIBLE);
+    if(!kthread_should_stop())
+      schedule_hrtimeout_range(&due, (unsigned long)period * NSEC_PER_USEC / 8,
+                               HRTIMER_MODE_ABS);
+    __set_current_state(TASK_RUNNING);
+  }
+
+  ads7870_rt_detach(current);
+  return 0;
+}
+
+/*
+ * Frames available to a reader
+ * Moves the cursor past frames that have been overwritten.
+ * Must be called with ring_lock held.
+ */
+static u64 ads7870_stream_avail(struct ads7870_stream_reader *r)
+{
+  u64 size = (u64)ring_mask + 1;
+
+  if(ring_head - r->cursor > size)
+  {
+    r->overruns += ring_head - size - r->cursor;
+    r->cursor = ring_head - size;
+  }
+
+  return ring_head - r->cursor;
+}
+
+/*
+ * True when need frames are available to a reader
+ * Takes ring_lock, as the 64 bit ring_head can not be read in
+ * one access on 32 bit targets. For wait and poll conditions.
+ */
+static bool ads7870_stream_ready(struct ads7870_stream_reader *r, u64 need)
+{
+  bool ready;
+
+  spin_lock_irq(&ring_lock);
+  ready = ring_head - r->cursor >= need;
+  spin_unlock_irq(&ring_lock);
+
+  return ready;
+}
+
+int ads7870_stream_open(struct file *filep)
+{
+  struct ads7870_stream_reader *r;
+  int err = 0;
+
+  r = kzalloc(sizeof(*r), GFP_KERNEL);
+  if(!r)
+    return -ENOMEM;
+
+  mutex_init(&r->lock);
+  r->layout = ADS7870_LAYOUT_INTERLEAVED;
+  r->block_len = 1;
+  r->bounce_frames = STREAM_BOUNCE_FRAMES;
+  r->bounce = vmalloc(r->bounce_frames * sizeof(struct ads7870_frame));
+  if(!r->bounce)
+  {
+    kfree(r);
+    return -ENOMEM;
+  }
+
+  /* New readers start with the next frame produced */
+  spin_lock_irq(&ring_lock);
+  r->cursor = ring_head;
+  spin_unlock_irq(&ring_lock);
+
+  mutex_lock(&stream_users_lock);
+  if(stream_users++ == 0)
+  {
+    stream_task = kthread_run(ads7870_stream_thread, NULL, "ads7870-stream");
+    if(IS_ERR(stream_task))
+    {
+      err = PTR_ERR(stream_task);
+      stream_task = NULL;
+      stream_users--;
+    }
+  }
+  mutex_unlock(&stream_users_lock);
+
+  if(err)
+  {
+    vfree(r->bounce);
+    kfree(r);
+    return err;
+  }
+
+  filep->private_data = r;
+  return 0;
+}
+
+void ads7870_stream_release(struct file *filep)
+{
+  struct ads7870_stream_reader *r = filep->private_data;
+
+  mutex_lock(&stream_users_lock);
+  if(--stream_users == 0 && stream_task)
+  {
+    kthread_stop(stream_task);
+    stream_task = NULL;
+  }
+  mutex_unlock(&stream_users_lock);
+
+  vfree(r->block);
+  vfree(r->bounce);
+  kfree(r);
+  filep->private_data = NULL;
+}
+
+static size_t ads7870_block_size(u32 block_len, unsigned int nbr_channels)
+{
+  return sizeof(struct ads7870_block) + nbr_channels * block_len * sizeof(s16);
+}
+
+/*
+ * Reorder block_len interleaved frames into one planar block
+ * Returns the size of the block written.
+ */
+static size_t ads7870_stream_planar(void *block, const struct ads7870_frame *frames, u32 block_len)
+{
+  struct ads7870_block *hdr = block;
+  s16 *samples = (s16 *)(hdr + 1);
+  unsigned int mask = 0;
+  s16 status = 0;
+  u32 i;
+  int ch;
+
+  for(i = 0; i < block_len; i++)
+  {
+    mask |= frames[i].channel_mask;
+    if(!status)
+      status = frames[i].status;
+  }
+
+  hdr->sequence = frames[0].sequence;
+  hdr->timestamp_ns = frames[0].timestamp_ns;
+  hdr->block_len = block_len;
+  hdr->channel_mask = mask;
+  hdr->status = status;
+
+  for(ch = 0; ch < ADS7870_NBR_CHANNELS; ch++)
+  {
+    if(!(mask & (1 << ch)))
+      continue;
+
+    for(i = 0; i < block_len; i++)
+      *samples++ = (frames[i].channel_mask & (1 << ch)) ? frames[i].value[ch] : 0;
+  }
+
+  return (char *)samples - (char *)block;
+}
+
+/* Frames making up one unit of output, a frame or a planar block */
+static size_t ads7870_stream_need(struct ads7870_stream_reader *r)
+{
+  return r->layout == ADS7870_LAYOUT_PLANAR ? r->block_len : 1;
+}
+
+/* Largest size of one unit of output */
+static size_t ads7870_stream_unit_size(struct ads7870_stream_reader *r)
+{
+  return r->layout == ADS7870_LAYOUT_PLANAR ?
+    ads7870_block_size(r->block_len, ADS7870_NBR_CHANNELS) :
+    sizeof(struct ads7870_frame);
+}
+
+/* Count frames a reader took but could not deliver */
+static void ads7870_stream_lost(struct ads7870_stream_reader *r, u64 frames)
+{
+  spin_lock_irq(&ring_lock);
+  r->overruns += frames;
+  spin_unlock_irq(&ring_lock);
+}
+
+/*
+ * Move up to units frames or blocks from the ring to the bounce buffer
+ * Waits for at least one unit unless nonblock is set. The frames are
+ * claimed under ring_lock but copied with interrupts enabled; frames
+ * the producer overwrote during the copy are dropped afterwards, in
+ * whole units, and counted as overruns.
+ * Returns the number of frames taken. Called with r->lock held.
+ */
+static ssize_t ads7870_stream_take(struct ads7870_stream_reader *r, size_t units, bool nonblock)
+{
+  size_t need = ads7870_stream_need(r);
+  u64 size = (u64)ring_mask + 1;
+  size_t n, i, lost;
+  u64 avail, start, oldest;
+  int err;
+
+  for(;;)
+  {
+    spin_lock_irq(&ring_lock);
+    avail = ads7870_stream_avail(r);
+    if(avail < need)
+    {
+      spin_unlock_irq(&ring_lock);
+
+      if(nonblock)
+        return -EAGAIN;
+
+      err = wait_event_interruptible(ring_wait, ads7870_stream_ready(r, need));
+      if(err)
+        return err;
+      continue;
+    }
+
+    n = units * need;
+    if(n > r->bounce_frames)
+      n = r->bounce_frames;
+    if(n > avail)
+      n = avail;
+    n -= n % need;
+
+    start = r->cursor;
+    r->cursor += n;
+    spin_unlock_irq(&ring_lock);
+
+    for(i = 0; i < n; i++)
+      r->bounce[i] = ring[(start + i) & ring_mask];
+
+    /* Slots older than head - size have been reused */
+    spin_lock_irq(&ring_lock);
+    oldest = ring_head > size ? ring_head - size : 0;
+    lost = 0;
+    if(oldest > start)
+    {
+      lost = oldest - start >= n ? n : min_t(size_t, roundup((size_t)(oldest - start), need), n);
+      r->overruns += lost;
+    }
+    spin_unlock_irq(&ring_lock);
+
+    if(lost)
+      memmove(r->bounce, r->bounce + lost, (n - lost) * sizeof(r->bounce[0]));
+    if(n > lost)
+      return n - lost;
+  }
+}
+
+/*
+ * Format one unit of output from the bounce buffer
+ * Planar blocks are reordered here, once per block.
+ */
+static const void *ads7870_stream_unit(struct ads7870_stream_reader *r, size_t frame, size_t *len)
+{
+  if(r->layout == ADS7870_LAYOUT_PLANAR)
+  {
+    *len = ads7870_stream_planar(r->block, &r->bounce[frame], r->block_len);
+    return r->block;
+  }
+
+  *len = sizeof(struct ads7870_frame);
+  return &r->bounce[frame];
+}
+
+ssize_t ads7870_stream_read(struct file *filep, char __user *ubuf, size_t count)
+{
+  struct ads7870_stream_reader *r = filep->private_data;
+  size_t i, len, need, done = 0;
+  const void *unit;
+  ssize_t n;
+
+  if(mutex_lock_interruptible(&r->lock))
+    return -ERESTARTSYS;
+
+  if(count < ads7870_stream_unit_size(r))
+  {
+    n = -EINVAL;
+    goto out;
+  }
+
+  need = ads7870_stream_need(r);
+  n = ads7870_stream_take(r, count / ads7870_stream_unit_size(r),
+                          filep->f_flags & O_NONBLOCK);
+  if(n < 0)
+    goto out;
+
+  for(i = 0; i < n; i += need)
+  {
+    unit = ads7870_stream_unit(r, i, &len);
+    if(copy_to_user(ubuf + done, unit, len))
+    {
+      n = -EFAULT;
+      goto out;
+    }
+    done += len;
+  }
+
+  n = done;
+
+ out:
+  mutex_unlock(&r->lock);
+  return n;
+}
+
+/*
+ * splice_read
+ * Frames are formatted straight into freshly allocated pages that
+ * are handed over to the pipe, so logging to a file or socket with
+ * splice() or sendfile() involves no copy through user space.
+ */
+static void ads7870_stream_spd_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+  put_page(spd->pages[i]);
+}
+
+static const struct pipe_buf_operations ads7870_stream_pipe_buf_ops = {
+  .can_merge = 0,
+  .map       = generic_pipe_buf_map,
+  .unmap     = generic_pipe_buf_unmap,
+  .confirm   = generic_pipe_buf_confirm,
+  .release   = generic_pipe_buf_release,
+  .steal     = generic_pipe_buf_steal,
+  .get       = generic_pipe_buf_get,
+};
+
+/* Append len bytes to the pages of spd, allocating pages as needed */
+static int ads7870_stream_emit(struct splice_pipe_desc *spd, const void *src, size_t len)
+{
+  struct partial_page *part;
+  size_t chunk;
+
+  while(len)
+  {
+    part = spd->nr_pages ? &spd->partial[spd->nr_pages - 1] : NULL;
+    if(!part || part->len == PAGE_SIZE)
+    {
+      spd->pages[spd->nr_pages] = alloc_page(GFP_KERNEL);
+      if(!spd->pages[spd->nr_pages])
+        return -ENOMEM;
+      part = &spd->partial[spd->nr_pages++];
+      part->offset = 0;
+      part->len = 0;
+      part->private = 0;
+    }
+
+    chunk = min_t(size_t, len, PAGE_SIZE - part->len);
+    memcpy(page_address(spd->pages[spd->nr_pages - 1]) + part->len, src, chunk);
+    part->len += chunk;
+    src += chunk;
+    len -= chunk;
+  }
+
+  return 0;
+}
+
+/*
+ * Free buffer slots in the pipe
+ * Waits for a slot unless nonblock is set, so no frames are taken
+ * from the ring for a pipe that cannot hold them.
+ */
+static int ads7870_stream_pipe_slots(struct pipe_inode_info *pipe, bool nonblock)
+{
+  int slots;
+
+  for(;;)
+  {
+    pipe_lock(pipe);
+    if(!pipe->readers)
+    {
+      send_sig(SIGPIPE, current, 0);
+      slots = -EPIPE;
+    }
+    else
+      slots = pipe->buffers - pipe->nrbufs;
+    pipe_unlock(pipe);
+
+    if(slots)
+      return slots;
+    if(nonblock)
+      return -EAGAIN;
+
+    if(wait_event_interruptible(pipe->wait,
+                                pipe->nrbufs < pipe->buffers || !pipe->readers))
+      return -ERESTARTSYS;
+  }
+}
+
+ssize_t ads7870_stream_splice_read(struct file *filep, loff_t *ppos,
+                                   struct pipe_inode_info *pipe,
+                                   size_t len, unsigned int flags)
+{
+  struct ads7870_stream_reader *r = filep->private_data;
+  struct page *pages[PIPE_DEF_BUFFERS];
+  struct partial_page partial[PIPE_DEF_BUFFERS];
+  struct splice_pipe_desc spd = {
+    .pages       = pages,
+    .partial     = partial,
+    .nr_pages    = 0,
+    .flags       = flags,
+    .ops         = &ads7870_stream_pipe_buf_ops,
+    .spd_release = ads7870_stream_spd_release,
+  };
+  size_t i, unit_len, need, space, done = 0;
+  int slots;
+  const void *unit;
+  ssize_t n, ret;
+  bool nonblock;
+
+  if(mutex_lock_interruptible(&r->lock))
+    return -ERESTARTSYS;
+
+  nonblock = (flags & SPLICE_F_NONBLOCK) || (filep->f_flags & O_NONBLOCK);
+
+  /* Do not produce more than the pipe has room for */
+  slots = ads7870_stream_pipe_slots(pipe, nonblock);
+  if(slots < 0)
+  {
+    ret = slots;
+    goto out;
+  }
+  if(slots > PIPE_DEF_BUFFERS)
+    slots = PIPE_DEF_BUFFERS;
+  space = min_t(size_t, len, slots * PAGE_SIZE);
+
+  if(space < ads7870_stream_unit_size(r))
+  {
+    ret = -EINVAL;
+    goto out;
+  }
+
+  need = ads7870_stream_need(r);
+  n = ads7870_stream_take(r, space / ads7870_stream_unit_size(r), nonblock);
+  if(n < 0)
+  {
+    ret = n;
+    goto out;
+  }
+
+  for(i = 0; i < n; i += need)
+  {
+    unit = ads7870_stream_unit(r, i, &unit_len);
+    ret = ads7870_stream_emit(&spd, unit, unit_len);
+    if(ret)
+    {
+      while(spd.nr_pages)
+        put_page(pages[--spd.nr_pages]);
+      ads7870_stream_lost(r, n);
+      goto out;
+    }
+    done += unit_len;
+  }
+
+  ret = splice_to_pipe(pipe, &spd);
+
+  /* Data the pipe did not take is lost for this reader */
+  if(ret < 0)
+    ads7870_stream_lost(r, n);
+  else if(ret < done)
+    ads7870_stream_lost(r, div64_u64((u64)(done - ret) * n, done));
+
+ out:
+  mutex_unlock(&r->lock);
+  return ret;
+}
+
+/*
+ * Select interleaved frames or planar blocks for a reader
+ * The bounce buffer must hold at least one block of frames.
+ */
+static int ads7870_stream_set_layout(struct ads7870_stream_reader *r, const struct ads7870_layout *l)
+{
+  struct ads7870_frame *bounce;
+  size_t frames;
+  void *block = NULL;
+
+  if(l->layout != ADS7870_LAYOUT_INTERLEAVED && l->layout != ADS7870_LAYOUT_PLANAR)
+    return -EINVAL;
+  if(l->block_len < 1 || l->block_len > ADS7870_BLOCK_MAX || l->block_len > ring_mask + 1)
+    return -EINVAL;
+
+  frames = max_t(size_t, STREAM_BOUNCE_FRAMES, l->block_len);
+  bounce = vmalloc(frames * sizeof(struct ads7870_frame));
+  if(!bounce)
+    return -ENOMEM;
+
+  if(l->layout == ADS7870_LAYOUT_PLANAR)
+  {
+    block = vmalloc(ads7870_block_size(l->block_len, ADS7870_NBR_CHANNELS));
+    if(!block)
+    {
+      vfree(bounce);
+      return -ENOMEM;
+    }
+  }
+
+  vfree(r->bounce);
+  vfree(r->block);
+  r->bounce = bounce;
+  r->bounce_frames = frames;
+  r->block = block;
+  r->layout = l->layout;
+  r->block_len = l->block_len;
+
+  return 0;
+}
+
+unsigned int ads7870_stream_poll(struct file *filep, poll_table *wait)
+{
+  struct ads7870_stream_reader *r = filep->private_data;
+  u64 need = ads7870_stream_need(r);
+  unsigned int mask = 0;
+
+  poll_wait(filep, &ring_wait, wait);
+
+  if(ads7870_stream_ready(r, need))
+    mask |= POLLIN | POLLRDNORM;
+
+  return mask;
+}
+
+long ads7870_stream_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+  struct ads7870_stream_reader *r = filep->private_data;
+  struct ads7870_stream_stats stats;
+  struct ads7870_layout layout;
+  int err;
+
+  switch(cmd)
+  {
+    case ADS7870_IOC_STREAM_STATS:
+      spin_lock_irq(&ring_lock);
+      ads7870_stream_avail(r);
+      stats.head = ring_head;
+      stats.cursor = r->cursor;
+      stats.overruns = r->overruns;
+      spin_unlock_irq(&ring_lock);
+
+      if(copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+        return -EFAULT;
+      return 0;
+
+    case ADS7870_IOC_SET_LAYOUT:
+      if(copy_from_user(&layout, (void __user *)arg, sizeof(layout)))
+        return -EFAULT;
+
+      if(mutex_lock_interruptible(&r->lock))
+        return -ERESTARTSYS;
+      err = ads7870_stream_set_layout(r, &layout);
+      mutex_unlock(&r->lock);
+      return err;
+
+    case ADS7870_IOC_GET_LAYOUT:
+      if(mutex_lock_interruptible(&r->lock))
+        return -ERESTARTSYS;
+      layout.layout = r->layout;
+      layout.block_len = r->block_len;
+      mutex_unlock(&r->lock);
+      if(copy_to_user((void __user *)arg, &layout, sizeof(layout)))
+        return -EFAULT;
+      return 0;
+
+    default:
+      return -ENOTTY;
+  }
+}
+
+int ads7870_stream_init(void)
+{
+  unsigned int frames = stream_frames < 2 ? 2 : roundup_pow_of_two(stream_frames);
+
+  ring = vzalloc(frames * sizeof(struct ads7870_frame));
+  if(!ring)
+    return -ENOMEM;
+
+  ring_mask = frames - 1;
+  return 0;
+}
+
+void ads7870_stream_exit(void)
+{
+  vfree(ring);
+  ring = NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef ADS7870_STREAM_H
+#define ADS7870_STREAM_H
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include "ads7870-uapi.h"
+
+int ads7870_stream_open(struct file *filep);
+void ads7870_stream_release(struct file *filep);
+ssize_t ads7870_stream_read(struct file *filep, char __user *ubuf, size_t count);
+ssize_t ads7870_stream_splice_read(struct file *filep, loff_t *ppos,
+                                   struct pipe_inode_info *pipe,
+                                   size_t len, unsigned int flags);
+unsigned int ads7870_stream_poll(struct file *filep, poll_table *wait);
+long ads7870_stream_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
+void ads7870_stream_push(const struct ads7870_frame *frame);
+void ads7870_stream_scan(unsigned int mask, s64 stamp_ns, u32 flags);
+int ads7870_stream_init(void);
+void ads7870_stream_exit(void);
+
+#endif
@@ -0,0 +1,127 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ads7870
+
+#if !defined(ADS7870_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define ADS7870_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * ADS7870 tracepoints
+ * Enable with e.g. "trace-cmd record -e ads7870" or
+ * "perf record -e 'ads7870:*'". Disabled tracepoints cost a
+ * patched-out branch.
+ */
+
+TRACE_EVENT(ads7870_reg_read,
+  TP_PROTO(u8 addr, u16 value, u8 bits, int status),
+  TP_ARGS(addr, value, bits, status),
+  TP_STRUCT__entry(
+    __field(u8, addr)
+    __field(u16, value)
+    __field(u8, bits)
+    __field(int, status)
+  ),
+  TP_fast_assign(
+    __entry->addr = addr;
+    __entry->value = value;
+    __entry->bits = bits;
+    __entry->status = status;
+  ),
+  TP_printk("addr=0x%02x value=0x%04x bits=%u status=%d",
+            __entry->addr, __entry->value, __entry->bits, __entry->status)
+);
+
+TRACE_EVENT(ads7870_reg_write,
+  TP_PROTO(u8 addr, u8 value, int status),
+  TP_ARGS(addr, value, status),
+  TP_STRUCT__entry(
+    __field(u8, addr)
+    __field(u8, value)
+    __field(int, status)
+  ),
+  TP_fast_assign(
+    __entry->addr = addr;
+    __entry->value = value;
+    __entry->status = status;
+  ),
+  TP_printk("addr=0x%02x value=0x%02x status=%d",
+            __entry->addr, __entry->value, __entry->status)
+);
+
+TRACE_EVENT(ads7870_conv_start,
+  TP_PROTO(u8 channel),
+  TP_ARGS(channel),
+  TP_STRUCT__entry(
+    __field(u8, channel)
+  ),
+  TP_fast_assign(
+    __entry->channel = channel;
+  ),
+  TP_printk("channel=%u", __entry->channel)
+);
+
+TRACE_EVENT(ads7870_conv_poll,
+  TP_PROTO(u8 channel, unsigned int iteration, u8 status),
+  TP_ARGS(channel, iteration, status),
+  TP_STRUCT__entry(
+    __field(u8, channel)
+    __field(unsigned int, iteration)
+    __field(u8, status)
+  ),
+  TP_fast_assign(
+    __entry->channel = channel;
+    __entry->iteration = iteration;
+    __entry->status = status;
+  ),
+  TP_printk("channel=%u iteration=%u gainmux=0x%02x",
+            __entry->channel, __entry->iteration, __entry->status)
+);
+
+TRACE_EVENT(ads7870_conv_end,
+  TP_PROTO(u8 channel, s16 value, unsigned int polls, s64 duration_ns, int status),
+  TP_ARGS(channel, value, polls, duration_ns, status),
+  TP_STRUCT__entry(
+    __field(u8, channel)
+    __field(s16, value)
+    __field(unsigned int, polls)
+    __field(s64, duration_ns)
+    __field(int, status)
+  ),
+  TP_fast_assign(
+    __entry->channel = channel;
+    __entry->value = value;
+    __entry->polls = polls;
+    __entry->duration_ns = duration_ns;
+    __entry->status = status;
+  ),
+  TP_printk("channel=%u value=%d polls=%u duration_ns=%lld status=%d",
+            __entry->channel, __entry->value, __entry->polls,
+            __entry->duration_ns, __entry->status)
+);
+
+TRACE_EVENT(ads7870_batch,
+  TP_PROTO(int channels, s64 duration_ns, int status),
+  TP_ARGS(channels, duration_ns, status),
+  TP_STRUCT__entry(
+    __field(int, channels)
+    __field(s64, duration_ns)
+    __field(int, status)
+  ),
+  TP_fast_assign(
+    __entry->channels = channels;
+    __entry->duration_ns = duration_ns;
+    __entry->status = status;
+  ),
+  TP_printk("channels=%d duration_ns=%lld status=%d",
+            __entry->channels, __entry->duration_ns, __entry->status)
+);
+
+#endif /* ADS7870_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ads7870-trace
+#include <trace/define_trace.h>
@@ -0,0 +1,139 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include "ads7870-stream.h"
+#include "ads7870-trigger.h"
+
+/*
+ * External trigger input
+ *
+ * When trigger_gpio is set, every selected edge on that GPIO scans
+ * trigger_channels and pushes a frame to the stream ring, flagged
+ * ADS7870_FRAME_TRIGGERED and stamped with the time the edge
+ * interrupt was taken. The hard interrupt handler only records the
+ * time stamp; the conversions run in the interrupt thread, which
+ * is a real-time thread. Edges arriving while the timestamp queue
+ * is full are counted as missed.
+ *
+ * Can be exercised without hardware using gpio-mockup or gpio-sim:
+ * load with trigger_gpio set to a simulated line and toggle its
+ * pull through debugfs or configfs.
+ */
+
+#define TRIGGER_EDGE_RISING	1
+#define TRIGGER_EDGE_FALLING	2
+#define TRIGGER_QUEUE		32
+
+static int trigger_gpio = -1;
+module_param(trigger_gpio, int, S_IRUGO);
+MODULE_PARM_DESC(trigger_gpio, "GPIO starting a scan on each edge, -1 to disable (default -1)");
+
+static unsigned int trigger_edge = TRIGGER_EDGE_RISING;
+module_param(trigger_edge, uint, S_IRUGO);
+MODULE_PARM_DESC(trigger_edge, "Trigger edge: 1 rising, 2 falling, 3 both (default 1)");
+
+static unsigned int trigger_channels = 0xff;
+module_param(trigger_channels, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(trigger_channels, "Bitmask of channels scanned on a trigger (default 0xff)");
+
+static ktime_t trig_queue[TRIGGER_QUEUE];
+static unsigned int trig_head = 0, trig_tail = 0;
+static DEFINE_SPINLOCK(trig_lock);	/* Protects the queue and counters */
+static unsigned long trig_edges = 0;
+static unsigned long trig_missed = 0;
+static int trig_irq = -1;
+
+static irqreturn_t ads7870_trigger_hardirq(int irq, void *dev_id)
+{
+  ktime_t stamp = ktime_get();
+
+  spin_lock(&trig_lock);
+  trig_edges++;
+  if(trig_head - trig_tail < TRIGGER_QUEUE)
+    trig_queue[trig_head++ % TRIGGER_QUEUE] = stamp;
+  else
+    trig_missed++;
+  spin_unlock(&trig_lock);
+
+  return IRQ_WAKE_THREAD;
+}
+
+static bool ads7870_trigger_pop(ktime_t *stamp)
+{
+  bool found;
+
+  spin_lock_irq(&trig_lock);
+  found = trig_head != trig_tail;
+  if(found)
+    *stamp = trig_queue[trig_tail++ % TRIGGER_QUEUE];
+  spin_unlock_irq(&trig_lock);
+
+  return found;
+}
+
+static irqreturn_t ads7870_trigger_thread(int irq, void *dev_id)
+{
+  ktime_t stamp;
+
+  while(ads7870_trigger_pop(&stamp))
+    ads7870_stream_scan(trigger_channels, ktime_to_ns(stamp), ADS7870_FRAME_TRIGGERED);
+
+  return IRQ_HANDLED;
+}
+
+int ads7870_trigger_init(void)
+{
+  unsigned long flags = 0;
+  int err;
+
+  if(trigger_gpio < 0)
+    return 0;
+
+  if(trigger_edge & TRIGGER_EDGE_RISING)
+    flags |= IRQF_TRIGGER_RISING;
+  if(trigger_edge & TRIGGER_EDGE_FALLING)
+    flags |= IRQF_TRIGGER_FALLING;
+  if(!flags)
+    return -EINVAL;
+
+  err = gpio_request_one(trigger_gpio, GPIOF_IN, "ads7870-trigger");
+  if(err)
+    return err;
+
+  trig_irq = gpio_to_irq(trigger_gpio);
+  if(trig_irq < 0)
+  {
+    err = trig_irq;
+    goto err_gpio;
+  }
+
+  err = request_threaded_irq(trig_irq, ads7870_trigger_hardirq,
+                             ads7870_trigger_thread, flags,
+                             "ads7870-trigger", NULL);
+  if(err)
+    goto err_gpio;
+
+  mps_info("Trigger on GPIO %i, IRQ %i\n", trigger_gpio, trig_irq);
+  return 0;
+
+ err_gpio:
+  trig_irq = -1;
+  gpio_free(trigger_gpio);
+  return err;
+}
+
+void ads7870_trigger_exit(void)
+{
+  if(trig_irq < 0)
+    return;
+
+  free_irq(trig_irq, NULL);
+  gpio_free(trigger_gpio);
+  trig_irq = -1;
+
+  mps_info("Trigger edges %lu, missed %lu\n", trig_edges, trig_missed);
+}
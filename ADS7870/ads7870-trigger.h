@@ -0,0 +1,7 @@
+#ifndef ADS7870_TRIGGER_H
+#define ADS7870_TRIGGER_H
+
+int ads7870_trigger_init(void);
+void ads7870_trigger_exit(void);
+
+#endif
@@ -0,0 +1,196 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/device.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <plat/mcspi.h>
+#include <linux/module.h>
+#include "ads7870.h"
+#include "ads7870-spi.h"
+#include "ads7870-pm.h"
+#include "ads7870-tune.h"
+
+/*
+ * SPI clock and turbo mode autotuner
+ *
+ * Steps the SPI clock down from tune_max_hz through the McSPI
+ * clock dividers (48 MHz / 2^n), with turbo mode off and on. Each
+ * setting is verified by reading the ID register tune_reads times
+ * and writing and reading back test patterns in GAINMUX. The
+ * fastest setting without a single error is applied; when both
+ * turbo settings pass at that clock, turbo mode is used.
+ *
+ * Runs at probe with spi_tune=1, or at any time by writing to the
+ * spi_tune attribute of the SPI device. Reading the attribute
+ * shows the result of every step and the setting in use.
+ */
+
+#define ADS7870_MCSPI_CLK	48000000
+#define ADS7870_TUNE_STEPS	8
+
+static bool spi_tune = false;
+module_param(spi_tune, bool, S_IRUGO);
+MODULE_PARM_DESC(spi_tune, "Tune the SPI clock and turbo mode at load (default 0)");
+
+static unsigned int tune_max_hz = ADS7870_MCSPI_CLK;
+module_param(tune_max_hz, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(tune_max_hz, "Highest SPI clock tried by the tuner in Hz (default 48000000)");
+
+static unsigned int tune_reads = 64;
+module_param(tune_reads, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(tune_reads, "Verification passes at each tuning step (default 64)");
+
+/* GAINMUX patterns, CNVBSY (bit 7) left clear so no conversion starts */
+static const u8 tune_patterns[] = { 0x00, 0x7f, 0x55, 0x2a, 0x0f, 0x70 };
+
+struct ads7870_tune_step {
+  u32 speed_hz;
+  bool turbo;
+  unsigned int errors;
+};
+
+static DEFINE_MUTEX(tune_lock);		/* Protects the results and tuning */
+static struct ads7870_tune_step tune_steps[ADS7870_TUNE_STEPS * 2];
+static int tune_nbr_steps = 0;
+
+static void ads7870_tune_set(struct spi_device *spi, u32 speed_hz, bool turbo)
+{
+  struct omap2_mcspi_device_config *cfg = spi->controller_data;
+
+  if(cfg)
+    cfg->turbo_mode = turbo;
+  spi->max_speed_hz = speed_hz;
+  spi_setup(spi);
+}
+
+/* Errors seen with the current bus setting */
+static unsigned int ads7870_tune_verify(void)
+{
+  unsigned int errors = 0, i, j;
+  u8 value;
+
+  for(i = 0; i < tune_reads; i++)
+  {
+    if(ads7870_spi_read_reg8(ADS7870_ID, &value) || value != ADS7870_ID_VALUE)
+      errors++;
+
+    for(j = 0; j < ARRAY_SIZE(tune_patterns); j++)
+    {
+      if(ads7870_spi_write_reg8(ADS7870_GAINMUX, tune_patterns[j]) ||
+         ads7870_spi_read_reg8(ADS7870_GAINMUX, &value) ||
+         value != tune_patterns[j])
+        errors++;
+    }
+  }
+
+  return errors;
+}
+
+static int ads7870_tune_run(struct spi_device *spi)
+{
+  struct omap2_mcspi_device_config *cfg = spi->controller_data;
+  u32 best_hz = spi->max_speed_hz;
+  bool best_turbo = cfg ? cfg->turbo_mode : false;
+  struct ads7870_tune_step *step;
+  bool found = false;
+  int n, turbo, err;
+
+  err = ads7870_pm_get();
+  if(err)
+    return err;
+  ads7870_spi_lock();
+
+  tune_nbr_steps = 0;
+  for(n = 0; n < ADS7870_TUNE_STEPS && !found; n++)
+  {
+    u32 speed_hz = ADS7870_MCSPI_CLK >> n;
+
+    if(speed_hz > tune_max_hz)
+      continue;
+
+    /* Turbo mode is set in the McSPI device config, if present */
+    for(turbo = 0; turbo <= (cfg ? 1 : 0); turbo++)
+    {
+      ads7870_tune_set(spi, speed_hz, turbo);
+
+      step = &tune_steps[tune_nbr_steps++];
+      step->speed_hz = speed_hz;
+      step->turbo = turbo;
+      step->errors = ads7870_tune_verify();
+
+      if(!step->errors)
+      {
+        best_hz = speed_hz;
+        best_turbo = turbo;
+        found = true;
+      }
+    }
+  }
+
+  /* Fastest error free setting, or what we had if none passed */
+  ads7870_tune_set(spi, best_hz, best_turbo);
+  ads7870_spi_write_reg8(ADS7870_GAINMUX, 0);
+
+  ads7870_spi_unlock();
+  ads7870_pm_put();
+
+  if(!found)
+  {
+    mps_err("SPI tuning found no error free setting, keeping %u Hz\n", best_hz);
+    return -EIO;
+  }
+
+  mps_info("SPI tuned to %u Hz, turbo mode %s\n", best_hz, best_turbo ? "on" : "off");
+  return 0;
+}
+
+static ssize_t ads7870_tune_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+  struct spi_device *spi = to_spi_device(dev);
+  struct omap2_mcspi_device_config *cfg = spi->controller_data;
+  ssize_t len = 0;
+  int i;
+
+  mutex_lock(&tune_lock);
+  len += sprintf(buf + len, "speed_hz %u\nturbo %i\n",
+                 spi->max_speed_hz, cfg ? cfg->turbo_mode : 0);
+  for(i = 0; i < tune_nbr_steps; i++)
+    len += sprintf(buf + len, "step %9u Hz turbo %i errors %u\n",
+                   tune_steps[i].speed_hz, tune_steps[i].turbo, tune_steps[i].errors);
+  mutex_unlock(&tune_lock);
+
+  return len;
+}
+
+static ssize_t ads7870_tune_store(struct device *dev, struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+  int err;
+
+  mutex_lock(&tune_lock);
+  err = ads7870_tune_run(to_spi_device(dev));
+  mutex_unlock(&tune_lock);
+
+  return err ? err : count;
+}
+
+static DEVICE_ATTR(spi_tune, S_IRUGO | S_IWUSR, ads7870_tune_show, ads7870_tune_store);
+
+int ads7870_tune_probe(struct spi_device *spi)
+{
+  if(spi_tune)
+  {
+    /* A failed tuning leaves the board setting, which is not fatal */
+    mutex_lock(&tune_lock);
+    ads7870_tune_run(spi);
+    mutex_unlock(&tune_lock);
+  }
+
+  return device_create_file(&spi->dev, &dev_attr_spi_tune);
+}
+
+void ads7870_tune_remove(struct spi_device *spi)
+{
+  device_remove_file(&spi->dev, &dev_attr_spi_tune);
+}
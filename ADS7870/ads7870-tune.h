@@ -0,0 +1,8 @@
+#ifndef ADS7870_TUNE_H
+#define ADS7870_TUNE_H
+#include <linux/spi/spi.h>
+
+int ads7870_tune_probe(struct spi_device *spi);
+void ads7870_tune_remove(struct spi_device *spi);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef ADS7870_UAPI_H
+#define ADS7870_UAPI_H
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * ADS7870 user space interface
+ * Shared between the driver and applications using the
+ * /dev/adc* device nodes.
+ */
+#define ADS7870_NBR_CHANNELS		8
+
+/*
+ * Snapshot page (/dev/adcsnap)
+ *
+ * A background sampler keeps the latest conversion of every
+ * enabled channel in a single page, which can be mmap'ed
+ * read-only by any number of processes. The page is protected
+ * by a sequence counter: it is odd while the kernel is writing,
+ * and changes whenever the content has been updated.
+ */
+#define ADS7870_SNAP_MAGIC		0x41445335	/* "ADS5" */
+
+struct ads7870_snap_channel {
+  __u64 timestamp_ns;	/* CLOCK_MONOTONIC time of the conversion */
+  __u64 sequence;	/* Number of conversions made on this channel */
+  __s16 value;		/* Latest result */
+  __s16 status;		/* 0, or negative errno of the last conversion */
+  __u32 reserved;
+};
+
+struct ads7870_snap_page {
+  __u32 seq;		/* Odd while an update is in progress */
+  __u32 magic;		/* ADS7870_SNAP_MAGIC */
+  __u32 nbr_channels;	/* ADS7870_NBR_CHANNELS */
+  __u32 period_us;	/* Sampler period */
+  struct ads7870_snap_channel ch[ADS7870_NBR_CHANNELS];
+};
+
+/*
+ * Streaming device (/dev/adcstream)
+ *
+ * One producer scans the channels in stream_channels and appends
+ * a frame per scan to a shared ring. Every open file has its own
+ * read cursor; a reader that falls more than a ring length behind
+ * skips the lost frames, which are counted as overruns.
+ */
+struct ads7870_frame {
+  __u64 sequence;	/* Frame number, consecutive unless overrun */
+  __u64 timestamp_ns;	/* CLOCK_MONOTONIC time of the scan */
+  __u16 channel_mask;	/* Channels holding a valid value */
+  __s16 status;		/* 0, or negative errno of the scan */
+  __u32 flags;		/* ADS7870_FRAME_* */
+  __s16 value[ADS7870_NBR_CHANNELS];
+};
+
+/*
+ * Frame started by an edge on the trigger GPIO. timestamp_ns is
+ * then the time the edge interrupt was taken.
+ */
+#define ADS7870_FRAME_TRIGGERED		0x0001
+
+struct ads7870_stream_stats {
+  __u64 head;		/* Sequence number of the next frame produced */
+  __u64 cursor;		/* Sequence number of the next frame for this file */
+  __u64 overruns;	/* Frames this file has lost */
+};
+
+/*
+ * Stream layout, selected per open file
+ *
+ * INTERLEAVED: read() returns struct ads7870_frame records.
+ * PLANAR:      read() returns blocks of block_len frames, each a
+ *              struct ads7870_block followed by block_len samples
+ *              of every channel in channel_mask, lowest channel
+ *              first (s16 samples[nbr_channels][block_len]).
+ */
+#define ADS7870_LAYOUT_INTERLEAVED	0
+#define ADS7870_LAYOUT_PLANAR		1
+#define ADS7870_BLOCK_MAX		1024
+
+struct ads7870_layout {
+  __u32 layout;		/* ADS7870_LAYOUT_* */
+  __u32 block_len;	/* Frames per planar block, 1..ADS7870_BLOCK_MAX */
+};
+
+struct ads7870_block {
+  __u64 sequence;	/* Sequence number of the first frame */
+  __u64 timestamp_ns;	/* Time of the first frame */
+  __u32 block_len;	/* Frames in this block */
+  __u16 channel_mask;	/* Channels present in the block */
+  __s16 status;		/* First error among the frames, or 0 */
+};
+
+#define ADS7870_IOC_MAGIC		'A'
+#define ADS7870_IOC_STREAM_STATS	_IOR(ADS7870_IOC_MAGIC, 1, struct ads7870_stream_stats)
+#define ADS7870_IOC_SET_LAYOUT		_IOW(ADS7870_IOC_MAGIC, 2, struct ads7870_layout)
+#define ADS7870_IOC_GET_LAYOUT		_IOR(ADS7870_IOC_MAGIC, 3, struct ads7870_layout)
+
+#ifndef __KERNEL__
+/*
+ * Take a consistent copy of one channel from a mapped snapshot page.
+ * Retries until no update was in progress while copying.
+ */
+static inline void ads7870_snap_read(const volatile struct ads7870_snap_page *page,
+                                     int channel, struct ads7870_snap_channel *out)
+{
+  __u32 seq;
+
+  do
+  {
+    while((seq = page->seq) & 1)
+      ;
+    __sync_synchronize();
+    *out = *(const struct ads7870_snap_channel *)&page->ch[channel];
+    __sync_synchronize();
+  }
+  while(page->seq != seq);
+}
+#endif
+
+#endif
@@ -1,3 +1,4 @@
+#include "mps-log.h"
 #include <linux/err.h>
 #include <linux/ctype.h>
 #include <linux/cdev.h>
@@ -7,14 +8,23 @@
 #include <linux/module.h>
 #include "ads7870.h"
 #include "ads7870-spi.h"
+#include "ads7870-snap.h"
+#include "ads7870-cache.h"
+#include "ads7870-sched.h"
+#include "ads7870-stream.h"
+#include "ads7870-trigger.h"
+#include "ads7870-gpio.h"
+#include "ads7870-stats.h"
 
 #define ADS7870_MAJOR       64
 #define ADS7870_MINOR        0
 #define MAXLEN              64
 #define NBR_ADC_CH           8
+#define ADS7870_SNAP_MINOR   8
+#define ADS7870_STREAM_MINOR 9
+#define NBR_MINORS          10
 #define COMPLIMENTARY_BIT   11
 
-#define MODULE_DEBUG 0
 #define USECDEV 0
 
 /* Pointer to SPI Device */
@@ -24,54 +34,13 @@ static struct cdev ads7870Dev;
 struct file_operations ads7870_Fops;
 static int devno;
 
-#define ERRGOTO(label, ...)                     \
-  {                                             \
-  printk (__VA_ARGS__);                         \
-  goto label;                                   \
-  } while(0)
-
-
-/* Local Methods */
-int ads7870_convert(u8 channel, s16* value)
-{
-  /* Start Conversion */
-  u8 status;
-  int err = ads7870_spi_write_reg8(ADS7870_GAINMUX, 
-                                   ADS7870_GAIN_1X | 
-                                   ADS7870_CH_SINGLE_ENDED |
-                                   (channel & 0x07)| 
-                                   ADS7870_CONVERT);
-
-  if(err)
-    return err;
-  
-  /* poll ADS7870 until conversion is ready */
-  do
-  {
-    err = ads7870_spi_read_reg8(ADS7870_GAINMUX, &status);
-  }
-  while((!err) && ( (status & ADS7870_CONVERT) > 0));
-
-  /* Read Result - Register wise its handled via u16, however we want it in s16. */
-  err = ads7870_spi_read_reg16(ADS7870_RESULTLO, (u16*)value);
-  if(*value & ADS7870_RESULTLO_OVR)
-    printk(KERN_ALERT "ADS7870: Error! PGA Out of Range\n");
-  *value = *value >> 4; // right-align result, lower 4-bits are zero
-
-  //  if(MODULE_DEBUG)
-  printk(KERN_DEBUG "ADS7870: Channel %i result: %i mV\n", channel, *value);
-
-  return err;
-}
-
-
-
-
 static int __init ads7870_cdrv_init(void)
 {
   int err; 
   
-  printk("ads7870 driver initializing\n");  
+  mps_info("ads7870 driver initializing\n");  
+
+  ads7870_stats_init();
 
   err=ads7870_spi_init();
   if(err)
@@ -80,48 +49,89 @@ static int __init ads7870_cdrv_init(void)
   
   /* Allocate chrdev region */
   devno = MKDEV(ADS7870_MAJOR, ADS7870_MINOR);
-  err = register_chrdev_region(devno, NBR_ADC_CH, "ads7870");  
+  err = register_chrdev_region(devno, NBR_MINORS, "ads7870");  
   if(err)
     ERRGOTO(err_spi_init, "Failed registering char region (%d,%d) +%d, error %d\n",
-            ADS7870_MAJOR, ADS7870_MINOR, NBR_ADC_CH, err);
+            ADS7870_MAJOR, ADS7870_MINOR, NBR_MINORS, err);
+
+  ads7870_cache_init();
+
+  /* Start conversion request scheduler */
+  err = ads7870_sched_init();
+  if(err)
+    ERRGOTO(err_register, "Failed starting conversion scheduler, error %d\n", err);
+
+  /* Allocate snapshot page */
+  err = ads7870_snap_init();
+  if(err)
+    ERRGOTO(err_sched_init, "Failed allocating snapshot page, error %d\n", err);
+
+  /* Allocate stream ring */
+  err = ads7870_stream_init();
+  if(err)
+    ERRGOTO(err_snap_init, "Failed allocating stream ring, error %d\n", err);
   
   /* Register Char Device */
   cdev_init(&ads7870Dev, &ads7870_Fops);
-  err = cdev_add(&ads7870Dev, devno, NBR_ADC_CH);
+  err = cdev_add(&ads7870Dev, devno, NBR_MINORS);
   if (err)
-    ERRGOTO(err_register, "Error %d adding ADS7870 device\n", err);
+    ERRGOTO(err_stream_init, "Error %d adding ADS7870 device\n", err);
 
 
   
-  /* Configure ADS7870 according to data sheet */
-  ads7870_spi_write_reg8(ADS7870_REFOSC, 
-                         ADS7870_REFOSC_OSCR |
-                         ADS7870_REFOSC_OSCE |
-                         ADS7870_REFOSC_REFE |
-                         ADS7870_REFOSC_BUFE |
-                         ADS7870_REFOSC_R2V);
+  /* Digital I/O pins */
+  err = ads7870_gpio_init();
+  if(err)
+    ERRGOTO(err_cdev_add, "Failed registering digital I/O, error %d\n", err);
+
+  /* Optional external trigger, once the ADS7870 is configured */
+  err = ads7870_trigger_init();
+  if(err)
+    ERRGOTO(err_gpio_init, "Failed setting up trigger GPIO, error %d\n", err);
   
   return 0;
   
+  err_gpio_init:
+  ads7870_gpio_exit();
+
+  err_cdev_add:
+  cdev_del(&ads7870Dev);
+
+  err_stream_init:
+  ads7870_stream_exit();
+
+  err_snap_init:
+  ads7870_snap_exit();
+
+  err_sched_init:
+  ads7870_sched_exit();
+
   err_register:
-  unregister_chrdev_region(devno, NBR_ADC_CH);
+  unregister_chrdev_region(devno, NBR_MINORS);
 
   err_spi_init:
   ads7870_spi_exit();
   
   
   error:
+  ads7870_stats_exit();
   return err;
 }
 
 static void __exit ads7870_cdrv_exit(void)
 {
-  printk("ads7870 driver Exit\n");
+  mps_info("ads7870 driver Exit\n");
+  ads7870_trigger_exit();
+  ads7870_gpio_exit();
   cdev_del(&ads7870Dev);
 
-  unregister_chrdev_region(devno, NBR_ADC_CH);
+  ads7870_stream_exit();
+  ads7870_snap_exit();
+  ads7870_sched_exit();
+  unregister_chrdev_region(devno, NBR_MINORS);
 
   ads7870_spi_exit();
+  ads7870_stats_exit();
 }
 
 int ads7870_cdrv_open(struct inode *inode, struct file *filep)
@@ -129,14 +139,20 @@ int ads7870_cdrv_open(struct inode *inode, struct file *filep)
   int major = imajor(inode);
   int minor = iminor(inode);
 
-  printk("Opening ADS7870 Device [major], [minor]: %i, %i\n", major, minor);
+  mps_dbg("Opening ADS7870 Device [major], [minor]: %i, %i\n", major, minor);
 
-  if (minor > NBR_ADC_CH-1)
+  if (minor > NBR_MINORS-1)
   {
-    printk("Minor no out of range (0-%i): %i\n", NBR_ADC_CH, minor);
+    mps_err_ratelimited("Minor no out of range (0-%i): %i\n", NBR_MINORS, minor);
     return -ENODEV;
   }
 
+  if (minor == ADS7870_SNAP_MINOR)
+    return ads7870_snap_open();
+
+  if (minor == ADS7870_STREAM_MINOR)
+    return ads7870_stream_open(filep);
+
   return 0;
 }
 
@@ -145,10 +161,16 @@ int ads7870_cdrv_release(struct inode *inode, struct file *filep)
   int major = imajor(inode);
   int minor = iminor(inode);
 
-  printk("Closing ADS7870 Device [major], [minor]: %i, %i\n", major, minor);
+  mps_dbg("Closing ADS7870 Device [major], [minor]: %i, %i\n", major, minor);
 
-  if (minor > NBR_ADC_CH-1)
+  if (minor > NBR_MINORS-1)
     return -ENODEV;
+
+  if (minor == ADS7870_SNAP_MINOR)
+    ads7870_snap_release();
+
+  if (minor == ADS7870_STREAM_MINOR)
+    ads7870_stream_release(filep);
     
   return 0;
 }
@@ -161,9 +183,9 @@ ssize_t ads7870_cdrv_write(struct file *filep, const char __user *ubuf,
     
   minor = MINOR(filep->f_dentry->d_inode->i_rdev);
   if (minor != ADS7870_MINOR) {
-    printk(KERN_ALERT "ads7870 Write to wrong Minor No:%i \n", minor);
+    mps_err_ratelimited("ads7870 Write to wrong Minor No:%i \n", minor);
     return 0; }
-  printk(KERN_ALERT "Writing to ads7870 [Minor] %i \n", minor);
+  mps_dbg("Writing to ads7870 [Minor] %i \n", minor);
     
   len = count < MAXLEN ? count : MAXLEN;
   if(copy_from_user(kbuf, ubuf, len))
@@ -171,11 +193,9 @@ ssize_t ads7870_cdrv_write(struct file *filep, const char __user *ubuf,
 	
   kbuf[len] = '\0';   // Pad null termination to string
 
-  if(MODULE_DEBUG)
-    printk("string from user: %s\n", kbuf);
+  mps_dbg("string from user: %s\n", kbuf);
   sscanf(kbuf,"%i", &value);
-  if(MODULE_DEBUG)
-    printk("value %i\n", value);
+  mps_dbg("value %i\n", value);
 
   /*
    * Write something here
@@ -193,16 +213,21 @@ ssize_t ads7870_cdrv_read(struct file *filep, char __user *ubuf,
   int err;
     
   minor = MINOR(filep->f_dentry->d_inode->i_rdev);
+  if (minor == ADS7870_SNAP_MINOR)
+    return ads7870_snap_copy(ubuf, count, f_pos);
+  if (minor == ADS7870_STREAM_MINOR)
+    return ads7870_stream_read(filep, ubuf, count);
   if (minor > NBR_ADC_CH-1) {
-    printk(KERN_ALERT "ads7870 read from wrong Minor No:%i \n", minor);
+    mps_err_ratelimited("ads7870 read from wrong Minor No:%i \n", minor);
     return 0; }
-  if(MODULE_DEBUG)
-    printk(KERN_ALERT "Reading from ads7870 [Minor] %i \n", minor);
+  mps_dbg("Reading from ads7870 [Minor] %i \n", minor);
     
-  /* Start Conversion */
-  err = ads7870_convert((minor & 0xff), &result);
+  ads7870_stats_inc(reads);
+
+  /* Start Conversion, or use a fresh enough cached sample */
+  err = ads7870_cache_convert((minor & 0xff), &result);
   if(err)
-    return -EFAULT;
+    return err;
   
   /* Convert to string and copy to user space */
   count = snprintf (resultBuf, sizeof resultBuf, "%d\n", result);
@@ -213,7 +238,50 @@ ssize_t ads7870_cdrv_read(struct file *filep, char __user *ubuf,
   return count;
 }
 
+int ads7870_cdrv_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+  int minor = MINOR(filep->f_dentry->d_inode->i_rdev);
+
+  /* Only the snapshot page can be mapped */
+  if (minor != ADS7870_SNAP_MINOR)
+    return -ENODEV;
+
+  return ads7870_snap_mmap(filep, vma);
+}
+
+unsigned int ads7870_cdrv_poll(struct file *filep, poll_table *wait)
+{
+  int minor = MINOR(filep->f_dentry->d_inode->i_rdev);
+
+  if (minor == ADS7870_STREAM_MINOR)
+    return ads7870_stream_poll(filep, wait);
+
+  /* One-shot channels can always be read */
+  return POLLIN | POLLRDNORM;
+}
+
+ssize_t ads7870_cdrv_splice_read(struct file *filep, loff_t *ppos,
+                                 struct pipe_inode_info *pipe,
+                                 size_t len, unsigned int flags)
+{
+  int minor = MINOR(filep->f_dentry->d_inode->i_rdev);
 
+  /* Only the stream has data worth splicing */
+  if (minor != ADS7870_STREAM_MINOR)
+    return -EINVAL;
+
+  return ads7870_stream_splice_read(filep, ppos, pipe, len, flags);
+}
+
+long ads7870_cdrv_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+  int minor = MINOR(filep->f_dentry->d_inode->i_rdev);
+
+  if (minor == ADS7870_STREAM_MINOR)
+    return ads7870_stream_ioctl(filep, cmd, arg);
+
+  return -ENOTTY;
+}
 
 struct file_operations ads7870_Fops = 
 {
@@ -222,6 +290,11 @@ struct file_operations ads7870_Fops =
   .release = ads7870_cdrv_release,
   .write   = ads7870_cdrv_write,
   .read    = ads7870_cdrv_read,
+  .llseek  = default_llseek,
+  .mmap    = ads7870_cdrv_mmap,
+  .poll    = ads7870_cdrv_poll,
+  .splice_read = ads7870_cdrv_splice_read,
+  .unlocked_ioctl = ads7870_cdrv_ioctl,
 };
 
 module_init(ads7870_cdrv_init);
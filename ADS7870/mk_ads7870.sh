@@ -1,3 +1,5 @@
+insmod ../common/mps-spi-arb.ko
+insmod ../common/mps-stats.ko
 insmod hotplug_ads7870_spi_device.ko
 insmod ads7870mod.ko
 mknod /dev/adc0 c 64 0
@@ -8,3 +10,5 @@ mknod /dev/adc4 c 64 4
 mknod /dev/adc5 c 64 5
 mknod /dev/adc6 c 64 6
 mknod /dev/adc7 c 64 7
+mknod /dev/adcsnap c 64 8
+mknod /dev/adcstream c 64 9
@@ -0,0 +1,278 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/module.h>
+#include "dac7612-spi.h"
+#include "dac7612-stats.h"
+#include "dac7612-shadow.h"
+#include "dac7612-async.h"
+#include "dac7612-uapi.h"
+#include "dac7612-trace.h"
+
+/*
+ * Asynchronous writes
+ *
+ * Every file using them owns a pool of preallocated requests, each
+ * a complete SPI message with its own DMA safe buffer, so queueing
+ * an update allocates nothing. Requests go back to the pool from
+ * the completion callback, which also keeps the first error for
+ * the next call on the file to report.
+ *
+ * A file takes the bus arbiter with its first queued update and
+ * keeps it until its queue drains, so several updates can be
+ * queued with spi_async at once. Once another device waits for
+ * the bus, new updates wait for the queue to drain rather than
+ * extend the hold.
+ */
+
+struct dac7612_async_req {
+  struct dac7612_async *a;
+  struct list_head node;
+  struct spi_message msg;
+  struct spi_transfer t[DAC7612_NBR_CHANNELS];
+  int words;
+  bool timed;			/* queued is set */
+  ktime_t queued;
+  u16 tx[DAC7612_NBR_CHANNELS] ____cacheline_aligned;	/* DMA safe */
+};
+
+struct dac7612_async {
+  spinlock_t lock;		/* Protects free, inflight, queued and err */
+  struct list_head free;
+  unsigned int inflight;
+  unsigned int queued;		/* Updates holding the bus */
+  int err;			/* First failed update, cleared when reported */
+  wait_queue_head_t wait;	/* Request returned to the pool */
+  unsigned int depth;
+  struct dac7612_async_req req[0];
+};
+
+/*
+ * Take the bus for one more update
+ * Joins the bus hold of the updates already queued, unless another
+ * device waits for the bus.
+ */
+static int dac7612_async_get_bus(struct dac7612_async *a, bool nonblock)
+{
+  spin_lock_irq(&a->lock);
+  if(a->queued && !dac7612_spi_bus_contended())
+  {
+    a->queued++;
+    spin_unlock_irq(&a->lock);
+    return 0;
+  }
+  spin_unlock_irq(&a->lock);
+
+  /* With updates queued, the bus is ours until they complete */
+  if(nonblock)
+  {
+    if(!dac7612_spi_bus_trylock())
+      return -EAGAIN;
+  }
+  else
+  {
+    if(wait_event_interruptible(a->wait, !a->queued))
+      return -ERESTARTSYS;
+    dac7612_spi_bus_lock();
+  }
+
+  spin_lock_irq(&a->lock);
+  a->queued++;
+  spin_unlock_irq(&a->lock);
+  return 0;
+}
+
+/* Hand the bus back with the last queued update. Called with a->lock held. */
+static void dac7612_async_put_bus(struct dac7612_async *a)
+{
+  if(--a->queued == 0)
+    dac7612_spi_bus_unlock();
+}
+
+static void dac7612_async_complete(void *context)
+{
+  struct dac7612_async_req *r = context;
+  struct dac7612_async *a = r->a;
+  s64 duration_ns = 0;
+  unsigned long flags;
+  int i;
+
+  /* Traced like the synchronous writes */
+  if(r->timed)
+    duration_ns = ktime_to_ns(ktime_sub(ktime_get(), r->queued));
+  if(r->words == 1)
+    trace_dac7612_write(r->tx[0] >> 12, r->tx[0] & 0xfff, duration_ns, r->msg.status);
+  else
+    trace_dac7612_block(0, r->words, duration_ns, r->msg.status);
+  dac7612_stats_xfer(r->words, r->words * 2, duration_ns, r->msg.status);
+  if(r->words > 1)
+    dac7612_spi_latch_release();
+
+  if(!r->msg.status)
+    for(i = 0; i < r->words; i++)
+      dac7612_shadow_note((r->tx[i] >> 12) - DAC7612_CHANNEL_A, r->tx[i], 1);
+
+  /* Wake under the lock, a may be freed as soon as it is dropped */
+  spin_lock_irqsave(&a->lock, flags);
+  if(r->msg.status && !a->err)
+    a->err = r->msg.status;
+  list_add_tail(&r->node, &a->free);
+  a->inflight--;
+  dac7612_async_put_bus(a);
+  wake_up(&a->wait);
+  spin_unlock_irqrestore(&a->lock, flags);
+}
+
+struct dac7612_async *dac7612_async_alloc(unsigned int depth)
+{
+  struct dac7612_async *a;
+  unsigned int i;
+
+  if(!depth || depth > DAC7612_ASYNC_MAX)
+    return ERR_PTR(-EINVAL);
+
+  a = kzalloc(sizeof(*a) + depth * sizeof(a->req[0]), GFP_KERNEL);
+  if(!a)
+    return ERR_PTR(-ENOMEM);
+
+  spin_lock_init(&a->lock);
+  INIT_LIST_HEAD(&a->free);
+  init_waitqueue_head(&a->wait);
+  a->depth = depth;
+
+  for(i = 0; i < depth; i++)
+  {
+    a->req[i].a = a;
+    list_add_tail(&a->req[i].node, &a->free);
+  }
+
+  return a;
+}
+
+/*
+ * Free the pool once all requests are back
+ * Returns an error no call has reported yet.
+ */
+int dac7612_async_free(struct dac7612_async *a)
+{
+  int err;
+
+  if(!a)
+    return 0;
+
+  wait_event(a->wait, a->inflight == 0);
+
+  spin_lock_irq(&a->lock);
+  err = a->err;
+  spin_unlock_irq(&a->lock);
+
+  kfree(a);
+  return err;
+}
+
+/*
+ * Queue an update
+ * channel is DAC7612_NBR_CHANNELS for a pair updating both
+ * outputs, codes then holding (A, B). Waits for a free request
+ * and, when another device holds the bus, for the bus, unless
+ * nonblock is set.
+ */
+int dac7612_async_write(struct dac7612_async *a, int channel, const u16 *codes,
+                        bool nonblock)
+{
+  struct dac7612_async_req *r;
+  int i, err;
+
+  spin_lock_irq(&a->lock);
+  while(!a->err && list_empty(&a->free))
+  {
+    spin_unlock_irq(&a->lock);
+    if(nonblock)
+      return -EAGAIN;
+    if(wait_event_interruptible(a->wait, !list_empty(&a->free)))
+      return -ERESTARTSYS;
+    spin_lock_irq(&a->lock);
+  }
+
+  err = a->err;
+  a->err = 0;
+  if(err)
+  {
+    spin_unlock_irq(&a->lock);
+    return err;
+  }
+
+  r = list_first_entry(&a->free, struct dac7612_async_req, node);
+  list_del(&r->node);
+  a->inflight++;
+  spin_unlock_irq(&a->lock);
+
+  /* Chip select toggles between the words, each is latched */
+  spi_message_init(&r->msg);
+  r->msg.complete = dac7612_async_complete;
+  r->msg.context = r;
+  r->words = channel == DAC7612_NBR_CHANNELS ? DAC7612_NBR_CHANNELS : 1;
+  memset(r->t, 0, sizeof(r->t));
+
+  for(i = 0; i < r->words; i++)
+  {
+    r->tx[i] = (DAC7612_ADDR(r->words > 1 ? i : channel) << 12) | (codes[i] & 0xfff);
+    r->t[i].tx_buf = &r->tx[i];
+    r->t[i].len = 2;
+    r->t[i].cs_change = i < r->words - 1;
+    spi_message_add_tail(&r->t[i], &r->msg);
+  }
+
+  err = dac7612_async_get_bus(a, nonblock);
+  if(!err)
+  {
+    r->timed = mps_trace_enabled(dac7612_write) || mps_trace_enabled(dac7612_block) ||
+               mps_stats_latency;
+    if(r->timed)
+      r->queued = ktime_get();
+    if(r->words > 1)
+      dac7612_spi_latch_hold();
+
+    err = dac7612_spi_async(&r->msg);
+    if(err)
+    {
+      if(r->words > 1)
+        dac7612_spi_latch_release();
+
+      spin_lock_irq(&a->lock);
+      dac7612_async_put_bus(a);
+      spin_unlock_irq(&a->lock);
+    }
+  }
+
+  if(err)
+  {
+    spin_lock_irq(&a->lock);
+    list_add(&r->node, &a->free);
+    a->inflight--;
+    wake_up(&a->wait);
+    spin_unlock_irq(&a->lock);
+  }
+
+  return err;
+}
+
+/* Wait for every queued update to be sent */
+int dac7612_async_fsync(struct dac7612_async *a)
+{
+  int err;
+
+  if(wait_event_interruptible(a->wait, a->inflight == 0))
+    return -ERESTARTSYS;
+
+  spin_lock_irq(&a->lock);
+  err = a->err;
+  a->err = 0;
+  spin_unlock_irq(&a->lock);
+
+  return err;
+}
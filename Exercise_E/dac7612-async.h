@@ -0,0 +1,13 @@
+#ifndef DAC7612_ASYNC_H
+#define DAC7612_ASYNC_H
+#include <linux/types.h>
+
+struct dac7612_async;
+
+struct dac7612_async *dac7612_async_alloc(unsigned int depth);
+int dac7612_async_free(struct dac7612_async *a);
+int dac7612_async_write(struct dac7612_async *a, int channel, const u16 *codes,
+                        bool nonblock);
+int dac7612_async_fsync(struct dac7612_async *a);
+
+#endif
@@ -0,0 +1,105 @@
+#include "mps-log.h"
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include "dac7612-cal.h"
+
+/*
+ * Voltage to code conversion
+ *
+ * The calibration is turned into a fixed-point slope once, when it
+ * is set, so converting a value is a clamp, a multiply and a shift.
+ * The slope is codes per microvolt in 32.32 fixed point; clamping
+ * before the multiply keeps the product below 2^44.
+ */
+
+#define DAC7612_CAL_SHIFT	32
+
+struct dac7612_cal_chan {
+  struct dac7612_cal cal;
+  s64 span_uv;			/* full_uv - zero_uv, may be negative */
+  u64 slope;			/* Codes per uV, 32.32 fixed point */
+};
+
+static struct dac7612_cal_chan cal_chan[DAC7612_NBR_CHANNELS];
+static DEFINE_SPINLOCK(cal_lock);	/* Protects cal_chan */
+
+int dac7612_cal_set(int ch, const struct dac7612_cal *cal)
+{
+  struct dac7612_cal_chan *c = &cal_chan[ch];
+  s64 span = (s64)cal->full_uv - cal->zero_uv;
+  u64 slope;
+
+  if(span == 0)
+    return -EINVAL;
+
+  slope = div64_u64((u64)DAC7612_CODE_MAX << DAC7612_CAL_SHIFT, abs64(span));
+
+  spin_lock(&cal_lock);
+  c->cal.zero_uv = cal->zero_uv;
+  c->cal.full_uv = cal->full_uv;
+  c->cal.saturated_low = 0;
+  c->cal.saturated_high = 0;
+  c->span_uv = span;
+  c->slope = slope;
+  spin_unlock(&cal_lock);
+
+  return 0;
+}
+
+void dac7612_cal_get(int ch, struct dac7612_cal *cal)
+{
+  spin_lock(&cal_lock);
+  *cal = cal_chan[ch].cal;
+  spin_unlock(&cal_lock);
+}
+
+/* Code nearest to uv, clamped to the calibrated range */
+u16 dac7612_cal_code(int ch, s64 uv)
+{
+  struct dac7612_cal_chan *c = &cal_chan[ch];
+  u64 d;
+  s64 delta;
+  u16 code;
+
+  spin_lock(&cal_lock);
+
+  /* Distance from the zero end towards the full end */
+  delta = uv - c->cal.zero_uv;
+  if(c->span_uv < 0)
+    delta = -delta;
+
+  if(delta <= 0)
+  {
+    if(delta < 0)
+      c->cal.saturated_low++;
+    code = 0;
+  }
+  else if(delta >= abs64(c->span_uv))
+  {
+    if(delta > abs64(c->span_uv))
+      c->cal.saturated_high++;
+    code = DAC7612_CODE_MAX;
+  }
+  else
+  {
+    d = (u64)delta * c->slope + (1ULL << (DAC7612_CAL_SHIFT - 1));
+    code = min_t(u64, d >> DAC7612_CAL_SHIFT, DAC7612_CODE_MAX);
+  }
+
+  spin_unlock(&cal_lock);
+  return code;
+}
+
+void dac7612_cal_init(void)
+{
+  struct dac7612_cal cal = {
+    .zero_uv = 0,
+    .full_uv = DAC7612_CODE_MAX * 1000,
+  };
+  int ch;
+
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+    dac7612_cal_set(ch, &cal);
+}
@@ -0,0 +1,11 @@
+#ifndef DAC7612_CAL_H
+#define DAC7612_CAL_H
+#include <linux/types.h>
+#include "dac7612-uapi.h"
+
+int dac7612_cal_set(int channel, const struct dac7612_cal *cal);
+void dac7612_cal_get(int channel, struct dac7612_cal *cal);
+u16 dac7612_cal_code(int channel, s64 uv);
+void dac7612_cal_init(void);
+
+#endif
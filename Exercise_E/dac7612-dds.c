@@ -0,0 +1,122 @@
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include "dac7612-dds.h"
+
+/*
+ * Direct digital synthesis
+ *
+ * The sine is looked up in a 1024 entry table with linear
+ * interpolation; triangle, square and sawtooth follow directly
+ * from the phase. Everything is integer arithmetic on the tick.
+ * All values are Q15, -32767..32767.
+ */
+
+#define DDS_TABLE_BITS		10
+#define DDS_TABLE_LEN		(1 << DDS_TABLE_BITS)
+#define DDS_AMPLITUDE_MAX	2048
+
+/* sin(2 pi / 1024) and 2 cos(2 pi / 1024), Q30 */
+#define DDS_SIN_STEP		6588356LL
+#define DDS_COS2_STEP		2147443222LL
+
+static s16 dds_sine[DDS_TABLE_LEN + 1];	/* Last entry repeats the first */
+
+/*
+ * Build the sine table
+ * The first quarter comes from the recurrence
+ * sin((n + 1) w) = 2 cos(w) sin(n w) - sin((n - 1) w), in Q30 with
+ * rounding, which stays well below an LSB of Q15 over a quarter.
+ * The rest follows by symmetry.
+ */
+void dac7612_dds_init(void)
+{
+  s64 prev = 0, cur = DDS_SIN_STEP, next;
+  int n;
+
+  dds_sine[0] = 0;
+  for(n = 1; n <= DDS_TABLE_LEN / 4; n++)
+  {
+    dds_sine[n] = (cur * 32767 + (1 << 29)) >> 30;
+    next = ((DDS_COS2_STEP * cur + (1 << 29)) >> 30) - prev;
+    prev = cur;
+    cur = next;
+  }
+  dds_sine[DDS_TABLE_LEN / 4] = 32767;
+
+  for(n = 1; n < DDS_TABLE_LEN / 4; n++)
+    dds_sine[DDS_TABLE_LEN / 2 - n] = dds_sine[n];
+  dds_sine[DDS_TABLE_LEN / 2] = 0;
+  for(n = 1; n < DDS_TABLE_LEN / 2; n++)
+    dds_sine[DDS_TABLE_LEN / 2 + n] = -dds_sine[n];
+  dds_sine[DDS_TABLE_LEN] = dds_sine[0];
+}
+
+int dac7612_dds_check(const struct dac7612_dds *cfg)
+{
+  if(cfg->waveform > DAC7612_WAVE_SAWTOOTH ||
+     cfg->amplitude > DDS_AMPLITUDE_MAX ||
+     cfg->offset > DAC7612_CODE_MAX ||
+     cfg->phase > 0xffff)
+    return -EINVAL;
+
+  return 0;
+}
+
+/* Phase step for the playback rate, computed once per setting */
+void dac7612_dds_rate(struct dac7612_dds_chan *c, u32 rate_hz)
+{
+  if(!rate_hz)
+  {
+    c->inc = 0;
+    return;
+  }
+
+  c->inc = div64_u64((u64)c->cfg.freq_mhz << 32, (u64)rate_hz * 1000);
+}
+
+static s32 dac7612_dds_wave(u32 waveform, u32 phase)
+{
+  u32 index, frac;
+  s32 a, b;
+
+  switch(waveform)
+  {
+    case DAC7612_WAVE_SINE:
+      index = phase >> (32 - DDS_TABLE_BITS);
+      frac = (phase >> (16 - DDS_TABLE_BITS)) & 0xffff;
+      a = dds_sine[index];
+      b = dds_sine[index + 1];
+      return a + (((b - a) * (s32)frac) >> 16);
+
+    case DAC7612_WAVE_TRIANGLE:
+      /* Up during the first half turn, down during the second */
+      index = phase >> 15;
+      if(index < 0x10000)
+        return max_t(s32, (s32)index - 32768, -32767);
+      return max_t(s32, 32767 - (s32)(index - 0x10000), -32767);
+
+    case DAC7612_WAVE_SQUARE:
+      return phase < 0x80000000 ? 32767 : -32767;
+
+    case DAC7612_WAVE_SAWTOOTH:
+      return max_t(s32, (s32)(phase >> 16) - 32768, -32767);
+
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Code for this tick, and advance the accumulator
+ */
+u16 dac7612_dds_next(struct dac7612_dds_chan *c)
+{
+  u32 phase = c->acc + (c->cfg.phase << 16);
+  s32 code;
+
+  code = dac7612_dds_wave(c->cfg.waveform, phase);
+  code = (s32)c->cfg.offset + ((code * (s32)c->cfg.amplitude + (1 << 14)) >> 15);
+  c->acc += c->inc;
+
+  return clamp_t(s32, code, 0, DAC7612_CODE_MAX);
+}
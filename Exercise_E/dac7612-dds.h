@@ -0,0 +1,20 @@
+#ifndef DAC7612_DDS_H
+#define DAC7612_DDS_H
+#include <linux/types.h>
+#include "dac7612-uapi.h"
+
+/*
+ * Generator state of one channel
+ */
+struct dac7612_dds_chan {
+  struct dac7612_dds cfg;
+  u32 acc;			/* Phase accumulator */
+  u32 inc;			/* Phase step per tick, from freq_mhz and the rate */
+};
+
+int dac7612_dds_check(const struct dac7612_dds *cfg);
+void dac7612_dds_rate(struct dac7612_dds_chan *c, u32 rate_hz);
+u16 dac7612_dds_next(struct dac7612_dds_chan *c);
+void dac7612_dds_init(void);
+
+#endif
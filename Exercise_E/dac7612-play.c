@@ -0,0 +1,407 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <asm/atomic.h>
+#include <asm/uaccess.h>
+#include <linux/module.h>
+#include "dac7612-spi.h"
+#include "dac7612-stats.h"
+#include "dac7612-play.h"
+#include "dac7612-dds.h"
+#include "dac7612-ring.h"
+#include "dac7612-shadow.h"
+
+/*
+ * Timer paced playback
+ *
+ * Tables loaded per channel, waveforms from the function
+ * generator or frames from the output ring are played back from
+ * an hrtimer, so the update rate does not depend on user space
+ * scheduling. Each tick queues one message updating every playing
+ * channel with spi_async, from a preallocated message and buffer.
+ * If the previous update, or another device, is still on the bus
+ * when a tick is due, the tick's update is dropped and counted as
+ * an underrun, so a busy bus never shifts the timing of later
+ * samples.
+ */
+
+static unsigned int play_late_us = 20;
+module_param(play_late_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(play_late_us, "Delay after which a playback tick is counted as late in microseconds (default 20)");
+
+enum dac7612_play_source {
+  PLAY_NONE,
+  PLAY_TABLE,
+  PLAY_DDS,
+  PLAY_RING,
+};
+
+struct dac7612_play_chan {
+  enum dac7612_play_source source;
+  u16 *table;			/* vmalloc'ed, NULL if not loaded */
+  u32 len;
+  u32 pos;			/* Next code to output */
+  struct dac7612_dds_chan dds;
+};
+
+static DEFINE_MUTEX(play_ctl_lock);	/* Serializes start and stop */
+static struct hrtimer play_timer;
+static DEFINE_SPINLOCK(play_lock);	/* Protects everything below */
+static struct dac7612_play_chan play_chan[DAC7612_NBR_CHANNELS];
+static ktime_t play_period;
+static u32 play_rate_hz = 0;
+static bool play_loop = false;
+static struct dac7612_play_stats play_stats;
+
+/* Update in flight, owned by the timer until play_busy is cleared */
+static struct spi_message play_msg;
+static struct spi_transfer play_t[DAC7612_NBR_CHANNELS];
+static u16 *play_tx = NULL;		/* DMA safe */
+static int play_words;
+static ktime_t play_queued;
+static atomic_t play_busy = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(play_idle);
+
+static void dac7612_play_complete(void *context)
+{
+  s64 duration_ns = ktime_to_ns(ktime_sub(ktime_get(), play_queued));
+  int i;
+
+  dac7612_stats_xfer(play_words, play_words * 2, duration_ns, play_msg.status);
+  if(!play_msg.status)
+    for(i = 0; i < play_words; i++)
+      dac7612_shadow_note((play_tx[i] >> 12) - DAC7612_CHANNEL_A, play_tx[i], 1);
+  if(play_words > 1)
+    dac7612_spi_latch_release();
+  dac7612_spi_bus_unlock();
+  atomic_set(&play_busy, 0);
+  wake_up(&play_idle);
+}
+
+/*
+ * Queue the next code of every playing channel
+ * Returns the number of channels still playing.
+ * Must be called with play_lock held.
+ */
+static int dac7612_play_output(ktime_t now)
+{
+  bool busy = atomic_read(&play_busy) || !dac7612_spi_bus_trylock();
+  u16 frame[DAC7612_NBR_CHANNELS];
+  struct dac7612_play_chan *c;
+  int ch, n = 0, active = 0;
+  int ring = -1;		/* Frame not taken yet */
+  u16 code;
+
+  /* The message is the previous update's until it completes */
+  if(!busy)
+  {
+    spi_message_init(&play_msg);
+    play_msg.complete = dac7612_play_complete;
+  }
+
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+  {
+    c = &play_chan[ch];
+    if(c->source == PLAY_RING)
+    {
+      /* A frame waits in the ring for a tick that can send it */
+      if(busy)
+      {
+        active++;
+        continue;
+      }
+
+      /* One frame per tick for all ring channels */
+      if(ring < 0)
+        ring = dac7612_ring_pop(frame);
+      if(!ring)
+      {
+        /* Empty, the output holds but the ring keeps playing */
+        active++;
+        continue;
+      }
+      code = frame[ch];
+    }
+    else if(c->source == PLAY_DDS)
+      code = dac7612_dds_next(&c->dds);
+    else if(c->source == PLAY_TABLE && c->pos < c->len)
+    {
+      code = c->table[c->pos++];
+      if(c->pos == c->len && play_loop)
+        c->pos = 0;
+    }
+    else
+      continue;
+    active++;
+
+    if(busy)
+      continue;
+
+    /* Chip select toggles between the words, each is latched */
+    play_tx[n] = (DAC7612_ADDR(ch) << 12) | (code & 0xfff);
+    memset(&play_t[n], 0, sizeof(play_t[n]));
+    play_t[n].tx_buf = &play_tx[n];
+    play_t[n].len = 2;
+    play_t[n].cs_change = 1;
+    spi_message_add_tail(&play_t[n], &play_msg);
+    n++;
+  }
+
+  if(active && busy)
+    play_stats.underruns++;
+
+  if(n)
+  {
+    play_t[n - 1].cs_change = 0;
+    play_words = n;
+    play_queued = now;
+    atomic_set(&play_busy, 1);
+
+    /* Both channels change together when LOADDACS is wired */
+    if(n > 1)
+      dac7612_spi_latch_hold();
+    if(dac7612_spi_async(&play_msg))
+    {
+      if(n > 1)
+        dac7612_spi_latch_release();
+      dac7612_spi_bus_unlock();
+      atomic_set(&play_busy, 0);
+      play_stats.underruns++;
+    }
+  }
+  else if(!busy)
+    dac7612_spi_bus_unlock();
+
+  return active;
+}
+
+static enum hrtimer_restart dac7612_play_tick(struct hrtimer *timer)
+{
+  ktime_t now = hrtimer_cb_get_time(timer);
+  s64 late_ns = ktime_to_ns(ktime_sub(now, hrtimer_get_expires(timer)));
+  enum hrtimer_restart restart = HRTIMER_RESTART;
+  unsigned long missed;
+
+  spin_lock(&play_lock);
+
+  play_stats.ticks++;
+  if(late_ns > (s64)play_late_us * NSEC_PER_USEC)
+    play_stats.late_ticks++;
+  if(late_ns > 0 && late_ns > play_stats.max_late_ns)
+    play_stats.max_late_ns = late_ns;
+
+  if(dac7612_play_output(now))
+  {
+    /* Whole periods the timer slept through are lost updates */
+    missed = hrtimer_forward(timer, now, play_period);
+    if(missed > 1)
+      play_stats.underruns += missed - 1;
+  }
+  else
+  {
+    play_stats.running = 0;
+    restart = HRTIMER_NORESTART;
+  }
+
+  spin_unlock(&play_lock);
+  return restart;
+}
+
+/*
+ * Load the table of a channel
+ * Loading while playing restarts that channel's table.
+ */
+int dac7612_play_load(int channel, const u16 __user *codes, u32 len)
+{
+  struct dac7612_play_chan *c = &play_chan[channel];
+  u16 *table, *old;
+
+  if(len == 0 || len > DAC7612_TABLE_MAX)
+    return -EINVAL;
+
+  table = vmalloc(len * sizeof(u16));
+  if(!table)
+    return -ENOMEM;
+
+  if(copy_from_user(table, codes, len * sizeof(u16)))
+  {
+    vfree(table);
+    return -EFAULT;
+  }
+
+  spin_lock_irq(&play_lock);
+  old = c->table;
+  c->table = table;
+  c->len = len;
+  c->pos = 0;
+  c->source = PLAY_TABLE;
+  spin_unlock_irq(&play_lock);
+
+  vfree(old);
+  return 0;
+}
+
+static void dac7612_play_halt(void)
+{
+  hrtimer_cancel(&play_timer);
+
+  spin_lock_irq(&play_lock);
+  play_stats.running = 0;
+  spin_unlock_irq(&play_lock);
+
+  /* The message and buffer are reused by the next start */
+  wait_event(play_idle, !atomic_read(&play_busy));
+}
+
+/*
+ * Generator settings of a channel
+ * Applied between two ticks. Takes precedence over a loaded
+ * table until the waveform is set to DAC7612_WAVE_NONE.
+ */
+int dac7612_play_dds(int channel, const struct dac7612_dds *cfg)
+{
+  struct dac7612_play_chan *c = &play_chan[channel];
+  int ch, err;
+
+  err = dac7612_dds_check(cfg);
+  if(err)
+    return err;
+
+  spin_lock_irq(&play_lock);
+  c->dds.cfg = *cfg;
+  dac7612_dds_rate(&c->dds, play_rate_hz);
+
+  if(cfg->waveform == DAC7612_WAVE_NONE)
+    c->source = c->table ? PLAY_TABLE : PLAY_NONE;
+  else
+    c->source = PLAY_DDS;
+
+  if(cfg->flags & DAC7612_DDS_SYNC)
+    for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+      play_chan[ch].dds.acc = 0;
+  spin_unlock_irq(&play_lock);
+
+  return 0;
+}
+
+/*
+ * Channels output from the ring
+ * Channels in the mask stop their table or generator, channels
+ * leaving it go back to their table.
+ */
+void dac7612_play_ring(u32 channel_mask)
+{
+  struct dac7612_play_chan *c;
+  int ch;
+
+  spin_lock_irq(&play_lock);
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+  {
+    c = &play_chan[ch];
+    if(channel_mask & (1 << ch))
+      c->source = PLAY_RING;
+    else if(c->source == PLAY_RING)
+      c->source = c->table ? PLAY_TABLE : PLAY_NONE;
+  }
+  spin_unlock_irq(&play_lock);
+}
+
+void dac7612_play_dds_get(int channel, struct dac7612_dds *cfg)
+{
+  spin_lock_irq(&play_lock);
+  *cfg = play_chan[channel].dds.cfg;
+  spin_unlock_irq(&play_lock);
+}
+
+void dac7612_play_stop(void)
+{
+  mutex_lock(&play_ctl_lock);
+  dac7612_play_halt();
+  mutex_unlock(&play_ctl_lock);
+}
+
+int dac7612_play_start(const struct dac7612_play *play)
+{
+  int ch, loaded = 0;
+
+  if(play->rate_hz == 0 || play->rate_hz > DAC7612_RATE_MAX)
+    return -EINVAL;
+
+  mutex_lock(&play_ctl_lock);
+  dac7612_play_halt();
+
+  spin_lock_irq(&play_lock);
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+  {
+    play_chan[ch].pos = 0;
+    play_chan[ch].dds.acc = 0;
+    dac7612_dds_rate(&play_chan[ch].dds, play->rate_hz);
+    if(play_chan[ch].source != PLAY_NONE)
+      loaded++;
+  }
+
+  if(!loaded)
+  {
+    spin_unlock_irq(&play_lock);
+    mutex_unlock(&play_ctl_lock);
+    return -ENODATA;
+  }
+
+  play_rate_hz = play->rate_hz;
+  play_period = ktime_set(0, NSEC_PER_SEC / play->rate_hz);
+  play_loop = play->flags & DAC7612_PLAY_LOOP;
+  memset(&play_stats, 0, sizeof(play_stats));
+  play_stats.running = 1;
+  spin_unlock_irq(&play_lock);
+
+  hrtimer_start(&play_timer, ktime_get(), HRTIMER_MODE_ABS);
+  mutex_unlock(&play_ctl_lock);
+  return 0;
+}
+
+void dac7612_play_stats(struct dac7612_play_stats *stats)
+{
+  int ch;
+
+  spin_lock_irq(&play_lock);
+  *stats = play_stats;
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+    stats->pos[ch] = play_chan[ch].pos;
+  spin_unlock_irq(&play_lock);
+}
+
+int dac7612_play_init(void)
+{
+  play_tx = kmalloc(DAC7612_NBR_CHANNELS * sizeof(u16), GFP_KERNEL);
+  if(!play_tx)
+    return -ENOMEM;
+
+  dac7612_dds_init();
+
+  hrtimer_init(&play_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  play_timer.function = dac7612_play_tick;
+
+  return 0;
+}
+
+void dac7612_play_exit(void)
+{
+  int ch;
+
+  dac7612_play_stop();
+
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+  {
+    vfree(play_chan[ch].table);
+    play_chan[ch].table = NULL;
+  }
+
+  kfree(play_tx);
+  play_tx = NULL;
+}
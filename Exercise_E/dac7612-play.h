@@ -0,0 +1,16 @@
+#ifndef DAC7612_PLAY_H
+#define DAC7612_PLAY_H
+#include <linux/types.h>
+#include "dac7612-uapi.h"
+
+int dac7612_play_load(int channel, const u16 __user *codes, u32 len);
+int dac7612_play_dds(int channel, const struct dac7612_dds *cfg);
+void dac7612_play_ring(u32 channel_mask);
+void dac7612_play_dds_get(int channel, struct dac7612_dds *cfg);
+int dac7612_play_start(const struct dac7612_play *play);
+void dac7612_play_stop(void);
+void dac7612_play_stats(struct dac7612_play_stats *stats);
+int dac7612_play_init(void);
+void dac7612_play_exit(void);
+
+#endif
@@ -0,0 +1,187 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <asm/atomic.h>
+#include <linux/module.h>
+#include "dac7612-ring.h"
+
+/*
+ * mmap'ed output ring
+ *
+ * User space and the playback tick share the ring without locks or
+ * copies: the producer index is only written by user space and
+ * the consumer index only by the tick. The kernel keeps its own
+ * copy of the geometry, so a corrupted header cannot make the tick
+ * access memory outside the ring.
+ */
+
+static struct dac7612_ring_header *ring_hdr = NULL;	/* vmalloc_user'ed */
+static struct dac7612_ring_frame *ring_frames;
+static size_t ring_size;
+static u32 ring_mask;
+static u32 ring_low_watermark;
+static atomic_t ring_maps = ATOMIC_INIT(0);
+static DEFINE_SPINLOCK(ring_lock);	/* Protects ring_hdr and the geometry */
+static DECLARE_WAIT_QUEUE_HEAD(ring_wait);
+
+int dac7612_ring_setup(const struct dac7612_ring_setup *setup)
+{
+  struct dac7612_ring_header *hdr = NULL, *old;
+  size_t size = 0;
+
+  if(setup->frames)
+  {
+    if(!is_power_of_2(setup->frames) || setup->frames > DAC7612_RING_MAX ||
+       setup->low_watermark >= setup->frames)
+      return -EINVAL;
+
+    size = PAGE_ALIGN(PAGE_SIZE + setup->frames * sizeof(struct dac7612_ring_frame));
+    hdr = vmalloc_user(size);
+    if(!hdr)
+      return -ENOMEM;
+
+    hdr->magic = DAC7612_RING_MAGIC;
+    hdr->frames = setup->frames;
+    hdr->data_offset = PAGE_SIZE;
+    hdr->low_watermark = setup->low_watermark;
+  }
+
+  /* A mapped ring stays until it is unmapped */
+  spin_lock_irq(&ring_lock);
+  if(atomic_read(&ring_maps))
+  {
+    spin_unlock_irq(&ring_lock);
+    vfree(hdr);
+    return -EBUSY;
+  }
+
+  old = ring_hdr;
+  ring_hdr = hdr;
+  ring_frames = hdr ? (void *)hdr + PAGE_SIZE : NULL;
+  ring_size = size;
+  ring_mask = setup->frames - 1;
+  ring_low_watermark = setup->low_watermark;
+  spin_unlock_irq(&ring_lock);
+
+  vfree(old);
+  return 0;
+}
+
+/*
+ * Take the next frame, called on every playback tick
+ * Returns false, and counts an underrun, if the ring is empty.
+ */
+bool dac7612_ring_pop(u16 *codes)
+{
+  u32 prod, cons, level;
+  int ch;
+
+  spin_lock(&ring_lock);
+  if(!ring_hdr)
+  {
+    spin_unlock(&ring_lock);
+    return false;
+  }
+
+  prod = ACCESS_ONCE(ring_hdr->producer);
+  cons = ring_hdr->consumer;
+
+  /* Also rejects a producer index more than a ring ahead */
+  if(prod - cons - 1 > ring_mask)
+  {
+    ring_hdr->underruns++;
+    spin_unlock(&ring_lock);
+    return false;
+  }
+
+  /* Read the frame after seeing the producer index */
+  smp_rmb();
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+    codes[ch] = ACCESS_ONCE(ring_frames[cons & ring_mask].code[ch]);
+  smp_mb();
+  ring_hdr->consumer = ++cons;
+
+  level = prod - cons;
+  spin_unlock(&ring_lock);
+
+  if(level <= ring_low_watermark && waitqueue_active(&ring_wait))
+    wake_up_interruptible(&ring_wait);
+
+  return true;
+}
+
+static void dac7612_ring_vma_open(struct vm_area_struct *vma)
+{
+  atomic_inc(&ring_maps);
+}
+
+static void dac7612_ring_vma_close(struct vm_area_struct *vma)
+{
+  atomic_dec(&ring_maps);
+}
+
+static const struct vm_operations_struct dac7612_ring_vm_ops = {
+  .open  = dac7612_ring_vma_open,
+  .close = dac7612_ring_vma_close,
+};
+
+int dac7612_ring_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+  unsigned long flags;
+  int err;
+
+  if(vma->vm_pgoff != 0)
+    return -EINVAL;
+
+  spin_lock_irqsave(&ring_lock, flags);
+  if(!ring_hdr)
+    err = -ENODATA;
+  else if(vma->vm_end - vma->vm_start > ring_size)
+    err = -EINVAL;
+  else
+  {
+    /* Counted before mapping, so setup cannot free it meanwhile */
+    atomic_inc(&ring_maps);
+    err = 0;
+  }
+  spin_unlock_irqrestore(&ring_lock, flags);
+  if(err)
+    return err;
+
+  err = remap_vmalloc_range(vma, ring_hdr, 0);
+  if(err)
+  {
+    atomic_dec(&ring_maps);
+    return err;
+  }
+
+  vma->vm_ops = &dac7612_ring_vm_ops;
+  return 0;
+}
+
+unsigned int dac7612_ring_poll(struct file *filep, poll_table *wait)
+{
+  unsigned int mask = 0;
+  unsigned long flags;
+
+  poll_wait(filep, &ring_wait, wait);
+
+  spin_lock_irqsave(&ring_lock, flags);
+  if(ring_hdr &&
+     ACCESS_ONCE(ring_hdr->producer) - ring_hdr->consumer <= ring_low_watermark)
+    mask |= POLLOUT | POLLWRNORM;
+  spin_unlock_irqrestore(&ring_lock, flags);
+
+  return mask;
+}
+
+void dac7612_ring_exit(void)
+{
+  /* Mappings hold a module reference, so none are left here */
+  vfree(ring_hdr);
+  ring_hdr = NULL;
+}
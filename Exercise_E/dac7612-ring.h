@@ -0,0 +1,13 @@
+#ifndef DAC7612_RING_H
+#define DAC7612_RING_H
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include "dac7612-uapi.h"
+
+int dac7612_ring_setup(const struct dac7612_ring_setup *setup);
+bool dac7612_ring_pop(u16 *codes);
+int dac7612_ring_mmap(struct file *filep, struct vm_area_struct *vma);
+unsigned int dac7612_ring_poll(struct file *filep, poll_table *wait);
+void dac7612_ring_exit(void);
+
+#endif
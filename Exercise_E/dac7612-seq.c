@@ -0,0 +1,327 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <asm/atomic.h>
+#include <asm/uaccess.h>
+#include <linux/module.h>
+#include "dac7612-spi.h"
+#include "dac7612-stats.h"
+#include "dac7612-shadow.h"
+#include "dac7612-seq.h"
+
+/*
+ * Timed command lists
+ *
+ * A list of (channel, code, delay) entries is output from an
+ * hrtimer, which sleeps until the next entry is due and queues it
+ * with spi_async from a preallocated message, as the playback
+ * engine does. The time every entry went out is kept, so user
+ * space can compare it to the requested timing afterwards.
+ */
+
+#define DAC7612_SEQ_BATCH	8		/* Entries due together in one message */
+#define DAC7612_SEQ_RETRY_NS	2000		/* Poll interval while our update is on the bus */
+#define DAC7612_SEQ_BUS_RETRY_NS 50000		/* Poll interval while another device holds it */
+
+static unsigned int seq_late_us = 20;
+module_param(seq_late_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(seq_late_us, "Delay after which a list entry is counted as late in microseconds (default 20)");
+
+static DEFINE_MUTEX(seq_ctl_lock);	/* Serializes start, abort and the lists */
+static struct hrtimer seq_timer;
+static DEFINE_SPINLOCK(seq_lock);	/* Protects everything below */
+static struct dac7612_seq_entry *seq_list = NULL;	/* vmalloc'ed */
+static u64 *seq_actual = NULL;		/* Output time of each entry */
+static u32 seq_pos;			/* Next entry to output */
+static u64 seq_due;			/* Due time of seq_pos after the start */
+static ktime_t seq_start_time;
+static struct dac7612_seq_status seq_stat;
+
+/* Update in flight, owned by the timer until seq_busy is cleared */
+static struct spi_message seq_msg;
+static struct spi_transfer seq_t[DAC7612_SEQ_BATCH];
+static u16 *seq_tx = NULL;		/* DMA safe */
+static int seq_words;
+static ktime_t seq_queued;
+static atomic_t seq_busy = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(seq_idle);
+
+static void dac7612_seq_complete(void *context)
+{
+  s64 duration_ns = ktime_to_ns(ktime_sub(ktime_get(), seq_queued));
+  unsigned long flags;
+  int i;
+
+  dac7612_stats_xfer(seq_words, seq_words * 2, duration_ns, seq_msg.status);
+  if(seq_words > 1)
+    dac7612_spi_latch_release();
+  dac7612_spi_bus_unlock();
+
+  spin_lock_irqsave(&seq_lock, flags);
+  if(seq_msg.status)
+  {
+    seq_stat.state = DAC7612_SEQ_FAILED;
+    seq_stat.error = seq_msg.status;
+  }
+  else
+  {
+    for(i = 0; i < seq_words; i++)
+      dac7612_shadow_note((seq_tx[i] >> 12) - DAC7612_CHANNEL_A, seq_tx[i], 1);
+    if(seq_stat.state == DAC7612_SEQ_RUNNING && seq_pos == seq_stat.len)
+      seq_stat.state = DAC7612_SEQ_DONE;
+  }
+  spin_unlock_irqrestore(&seq_lock, flags);
+
+  atomic_set(&seq_busy, 0);
+  wake_up(&seq_idle);
+}
+
+static enum hrtimer_restart dac7612_seq_tick(struct hrtimer *timer)
+{
+  ktime_t now = hrtimer_cb_get_time(timer);
+  s64 actual_ns = ktime_to_ns(ktime_sub(now, seq_start_time));
+  s64 late_ns;
+  struct dac7612_seq_entry *e;
+  enum hrtimer_restart restart = HRTIMER_NORESTART;
+  int n = 0, err;
+
+  spin_lock(&seq_lock);
+
+  if(seq_stat.state != DAC7612_SEQ_RUNNING)
+    goto out;
+
+  /* The previous update is still on the bus, the entry waits for it */
+  if(atomic_read(&seq_busy))
+  {
+    hrtimer_set_expires(timer, ktime_add_ns(now, DAC7612_SEQ_RETRY_NS));
+    restart = HRTIMER_RESTART;
+    goto out;
+  }
+
+  /*
+   * Another device may hold the bus for a long batch, so poll
+   * slowly rather than flood the CPU with timer interrupts
+   */
+  if(!dac7612_spi_bus_trylock())
+  {
+    seq_stat.bus_retries++;
+    hrtimer_set_expires(timer, ktime_add_ns(now, DAC7612_SEQ_BUS_RETRY_NS));
+    restart = HRTIMER_RESTART;
+    goto out;
+  }
+
+  late_ns = actual_ns - (s64)seq_due;
+  if(late_ns > (s64)seq_late_us * NSEC_PER_USEC)
+    seq_stat.late_entries++;
+  if(late_ns > 0)
+  {
+    seq_stat.total_late_ns += late_ns;
+    if(late_ns > seq_stat.max_late_ns)
+      seq_stat.max_late_ns = late_ns;
+  }
+
+  /* This entry and those following it with no delay */
+  spi_message_init(&seq_msg);
+  seq_msg.complete = dac7612_seq_complete;
+  do
+  {
+    e = &seq_list[seq_pos];
+    seq_tx[n] = (DAC7612_ADDR(e->channel) << 12) | (e->code & 0xfff);
+    memset(&seq_t[n], 0, sizeof(seq_t[n]));
+    seq_t[n].tx_buf = &seq_tx[n];
+    seq_t[n].len = 2;
+    seq_t[n].cs_change = 1;
+    spi_message_add_tail(&seq_t[n], &seq_msg);
+    seq_actual[seq_pos++] = actual_ns;
+    n++;
+  }
+  while(seq_pos < seq_stat.len && n < DAC7612_SEQ_BATCH &&
+        seq_list[seq_pos].delay_ns == 0);
+
+  seq_t[n - 1].cs_change = 0;
+  seq_words = n;
+  seq_queued = now;
+  seq_stat.done = seq_pos;
+  seq_stat.requested_ns = seq_due;
+  seq_stat.actual_ns = actual_ns;
+
+  /* Entries due together change together when LOADDACS is wired */
+  atomic_set(&seq_busy, 1);
+  if(n > 1)
+    dac7612_spi_latch_hold();
+  err = dac7612_spi_async(&seq_msg);
+  if(err)
+  {
+    if(n > 1)
+      dac7612_spi_latch_release();
+    dac7612_spi_bus_unlock();
+    atomic_set(&seq_busy, 0);
+    seq_stat.state = DAC7612_SEQ_FAILED;
+    seq_stat.error = err;
+    goto out;
+  }
+
+  if(seq_pos < seq_stat.len)
+  {
+    seq_due += seq_list[seq_pos].delay_ns;
+    hrtimer_set_expires(timer, ktime_add_ns(seq_start_time, seq_due));
+    restart = HRTIMER_RESTART;
+  }
+
+out:
+  spin_unlock(&seq_lock);
+  return restart;
+}
+
+/* Called with seq_ctl_lock held */
+static void dac7612_seq_halt(void)
+{
+  hrtimer_cancel(&seq_timer);
+
+  spin_lock_irq(&seq_lock);
+  if(seq_stat.state == DAC7612_SEQ_RUNNING)
+    seq_stat.state = DAC7612_SEQ_ABORTED;
+  spin_unlock_irq(&seq_lock);
+
+  /* The message and buffer are reused by the next start */
+  wait_event(seq_idle, !atomic_read(&seq_busy));
+}
+
+int dac7612_seq_start(const struct dac7612_seq *seq)
+{
+  struct dac7612_seq_entry *list, *old_list;
+  u64 *actual, *old_actual;
+  u64 total = 0;
+  u32 i;
+  int err;
+
+  if(seq->len == 0 || seq->len > DAC7612_SEQ_MAX || seq->flags)
+    return -EINVAL;
+
+  list = vmalloc(seq->len * sizeof(*list));
+  actual = vzalloc(seq->len * sizeof(*actual));
+  if(!list || !actual)
+  {
+    err = -ENOMEM;
+    goto err_free;
+  }
+
+  if(copy_from_user(list, (const void __user *)(unsigned long)seq->entries,
+                    seq->len * sizeof(*list)))
+  {
+    err = -EFAULT;
+    goto err_free;
+  }
+
+  /* Keep the due times well inside a ktime_t */
+  for(i = 0; i < seq->len; i++)
+  {
+    total += list[i].delay_ns;
+    if(list[i].channel >= DAC7612_NBR_CHANNELS || list[i].code > DAC7612_CODE_MAX ||
+       list[i].delay_ns > KTIME_MAX / 4 || total > KTIME_MAX / 4)
+    {
+      err = -EINVAL;
+      goto err_free;
+    }
+  }
+
+  mutex_lock(&seq_ctl_lock);
+  dac7612_seq_halt();
+
+  spin_lock_irq(&seq_lock);
+  old_list = seq_list;
+  old_actual = seq_actual;
+  seq_list = list;
+  seq_actual = actual;
+  seq_pos = 0;
+  seq_due = list[0].delay_ns;
+  memset(&seq_stat, 0, sizeof(seq_stat));
+  seq_stat.state = DAC7612_SEQ_RUNNING;
+  seq_stat.len = seq->len;
+  seq_start_time = ktime_get();
+  spin_unlock_irq(&seq_lock);
+
+  hrtimer_start(&seq_timer, ktime_add_ns(seq_start_time, seq_due), HRTIMER_MODE_ABS);
+  mutex_unlock(&seq_ctl_lock);
+
+  vfree(old_list);
+  vfree(old_actual);
+  return 0;
+
+err_free:
+  vfree(list);
+  vfree(actual);
+  return err;
+}
+
+void dac7612_seq_abort(void)
+{
+  mutex_lock(&seq_ctl_lock);
+  dac7612_seq_halt();
+  mutex_unlock(&seq_ctl_lock);
+}
+
+void dac7612_seq_status(struct dac7612_seq_status *status)
+{
+  spin_lock_irq(&seq_lock);
+  *status = seq_stat;
+  spin_unlock_irq(&seq_lock);
+}
+
+/*
+ * Copy output times of entries already output
+ * Returns the number of entries copied.
+ */
+int dac7612_seq_times(const struct dac7612_seq_times *times)
+{
+  u32 done, n;
+  int err = 0;
+
+  mutex_lock(&seq_ctl_lock);
+
+  spin_lock_irq(&seq_lock);
+  done = seq_stat.done;
+  spin_unlock_irq(&seq_lock);
+
+  n = 0;
+  if(times->first < done)
+    n = min(times->len, done - times->first);
+
+  if(n && copy_to_user((void __user *)(unsigned long)times->times,
+                       &seq_actual[times->first], n * sizeof(u64)))
+    err = -EFAULT;
+
+  mutex_unlock(&seq_ctl_lock);
+  return err ? err : n;
+}
+
+int dac7612_seq_init(void)
+{
+  seq_tx = kmalloc(DAC7612_SEQ_BATCH * sizeof(u16), GFP_KERNEL);
+  if(!seq_tx)
+    return -ENOMEM;
+
+  hrtimer_init(&seq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  seq_timer.function = dac7612_seq_tick;
+
+  return 0;
+}
+
+void dac7612_seq_exit(void)
+{
+  dac7612_seq_abort();
+
+  vfree(seq_list);
+  vfree(seq_actual);
+  seq_list = NULL;
+  seq_actual = NULL;
+
+  kfree(seq_tx);
+  seq_tx = NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef DAC7612_SEQ_H
+#define DAC7612_SEQ_H
+#include <linux/types.h>
+#include "dac7612-uapi.h"
+
+int dac7612_seq_start(const struct dac7612_seq *seq);
+void dac7612_seq_abort(void);
+void dac7612_seq_status(struct dac7612_seq_status *status);
+int dac7612_seq_times(const struct dac7612_seq_times *times);
+int dac7612_seq_init(void);
+void dac7612_seq_exit(void);
+
+#endif
@@ -0,0 +1,287 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/module.h>
+#include "dac7612-spi.h"
+#include "dac7612-shadow.h"
+
+/*
+ * Output shadow and write coalescing
+ *
+ * The last code sent to each channel is kept, so writing the same
+ * setpoint again is free. With min_update_us set, a channel is not
+ * updated more often than that: a write arriving sooner is parked
+ * as pending, later writes replace it, and a timer sends the latest
+ * one when the interval is over. An error from such a deferred
+ * update is returned by the next write to the channel.
+ *
+ * Writes made by the block, playback and ring paths are recorded
+ * in the shadow, but never skipped or coalesced.
+ */
+
+static unsigned int min_update_us = 0;
+module_param(min_update_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(min_update_us, "Minimum interval between updates of a channel in microseconds, 0 to disable (default 0)");
+
+struct dac7612_shadow_chan {
+  u16 code;			/* On the output */
+  bool valid;			/* code is known */
+  u16 pending;			/* Waiting for the interval to end */
+  bool has_pending;
+  ktime_t last;			/* Time of the last update */
+  int err;			/* Deferred update failed */
+  u64 writes;
+  u64 bus_writes;
+};
+
+static struct dac7612_shadow_chan shadow[DAC7612_NBR_CHANNELS];
+static bool shadow_pending_ab = false;	/* Pending values go as a pair */
+static DEFINE_SPINLOCK(shadow_lock);	/* Protects shadow */
+static DEFINE_MUTEX(shadow_bus_lock);	/* Orders bus writes with the shadow */
+static struct hrtimer shadow_timer;
+static struct work_struct shadow_work;
+
+/* Record a completed update. Called with shadow_lock held. */
+static void dac7612_shadow_set(int ch, u16 code, unsigned int n, ktime_t now)
+{
+  struct dac7612_shadow_chan *c = &shadow[ch];
+
+  c->code = code;
+  c->valid = true;
+  c->last = now;
+  c->bus_writes += n;
+}
+
+/*
+ * Time the channel may be updated again
+ * Called with shadow_lock held.
+ */
+static ktime_t dac7612_shadow_due(int ch)
+{
+  return ktime_add_us(shadow[ch].last, min_update_us);
+}
+
+/* Called with shadow_lock held */
+static bool dac7612_shadow_early(int ch, ktime_t now)
+{
+  struct dac7612_shadow_chan *c = &shadow[ch];
+
+  if(!min_update_us || !c->valid)
+    return false;
+
+  return c->has_pending || ktime_to_ns(ktime_sub(dac7612_shadow_due(ch), now)) > 0;
+}
+
+/* Park a value until due. Called with shadow_lock held. */
+static void dac7612_shadow_park(int ch, u16 code, ktime_t due)
+{
+  shadow[ch].pending = code;
+  shadow[ch].has_pending = true;
+  if(!hrtimer_active(&shadow_timer))
+    hrtimer_start(&shadow_timer, due, HRTIMER_MODE_ABS);
+}
+
+int dac7612_shadow_write(int ch, u16 code)
+{
+  struct dac7612_shadow_chan *c = &shadow[ch];
+  ktime_t now = ktime_get();
+  int err, ret;
+
+  code &= DAC7612_CODE_MAX;
+
+  spin_lock_irq(&shadow_lock);
+  c->writes++;
+  err = c->err;
+  c->err = 0;
+
+  if(dac7612_shadow_early(ch, now))
+  {
+    dac7612_shadow_park(ch, code, dac7612_shadow_due(ch));
+    spin_unlock_irq(&shadow_lock);
+    return err;
+  }
+  if(c->valid && c->code == code)
+  {
+    spin_unlock_irq(&shadow_lock);
+    return err;
+  }
+  spin_unlock_irq(&shadow_lock);
+
+  mutex_lock(&shadow_bus_lock);
+  ret = dac7612_spi_write_reg14(DAC7612_ADDR(ch), code);
+  if(!ret)
+  {
+    spin_lock_irq(&shadow_lock);
+    dac7612_shadow_set(ch, code, 1, ktime_get());
+    spin_unlock_irq(&shadow_lock);
+  }
+  mutex_unlock(&shadow_bus_lock);
+
+  /* A deferred update failed first */
+  return err ? err : ret;
+}
+
+/*
+ * Pairs are skipped only if both channels are unchanged, and
+ * coalesced as pairs, so they stay simultaneous.
+ */
+int dac7612_shadow_write_ab(const u16 *codes)
+{
+  u16 pair[DAC7612_NBR_CHANNELS];
+  ktime_t now = ktime_get(), due = now;
+  bool same = true, parked = false;
+  int ch, err = 0, ret;
+
+  spin_lock_irq(&shadow_lock);
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+  {
+    pair[ch] = codes[ch] & DAC7612_CODE_MAX;
+    shadow[ch].writes++;
+    if(!err)
+      err = shadow[ch].err;
+    shadow[ch].err = 0;
+    if(!shadow[ch].valid || shadow[ch].code != pair[ch])
+      same = false;
+  }
+
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+    if(dac7612_shadow_early(ch, now))
+    {
+      parked = true;
+      if(ktime_to_ns(ktime_sub(dac7612_shadow_due(ch), due)) > 0)
+        due = dac7612_shadow_due(ch);
+    }
+
+  if(parked)
+  {
+    for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+      dac7612_shadow_park(ch, pair[ch], due);
+    shadow_pending_ab = true;
+  }
+  spin_unlock_irq(&shadow_lock);
+
+  if(parked || same)
+    return err;
+
+  mutex_lock(&shadow_bus_lock);
+  ret = dac7612_spi_write_ab(pair, 1);
+  if(!ret)
+  {
+    spin_lock_irq(&shadow_lock);
+    now = ktime_get();
+    for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+      dac7612_shadow_set(ch, pair[ch], 1, now);
+    spin_unlock_irq(&shadow_lock);
+  }
+  mutex_unlock(&shadow_bus_lock);
+
+  return err ? err : ret;
+}
+
+/*
+ * Record n writes made by another path, code being the last
+ * They supersede a value parked for the channel.
+ * May be called from interrupt context.
+ */
+void dac7612_shadow_note(int ch, u16 code, unsigned int n)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&shadow_lock, flags);
+  shadow[ch].writes += n;
+  shadow[ch].has_pending = false;
+  shadow_pending_ab = false;
+  dac7612_shadow_set(ch, code & DAC7612_CODE_MAX, n, ktime_get());
+  spin_unlock_irqrestore(&shadow_lock, flags);
+}
+
+void dac7612_shadow_get(int ch, struct dac7612_setpoint *sp)
+{
+  struct dac7612_shadow_chan *c = &shadow[ch];
+
+  spin_lock_irq(&shadow_lock);
+  sp->output = c->code;
+  sp->code = c->has_pending ? c->pending : c->code;
+  sp->pending = c->has_pending;
+  sp->writes = c->writes;
+  sp->bus_writes = c->bus_writes;
+  spin_unlock_irq(&shadow_lock);
+}
+
+/*
+ * Send the pending values
+ * Runs from a work item, as the timer cannot sleep on the bus.
+ */
+static void dac7612_shadow_flush(struct work_struct *work)
+{
+  u16 codes[DAC7612_NBR_CHANNELS];
+  bool has[DAC7612_NBR_CHANNELS];
+  bool ab;
+  int ch, err;
+
+  mutex_lock(&shadow_bus_lock);
+
+  spin_lock_irq(&shadow_lock);
+  ab = shadow_pending_ab;
+  shadow_pending_ab = false;
+  for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+  {
+    has[ch] = shadow[ch].has_pending;
+    codes[ch] = shadow[ch].pending;
+    shadow[ch].has_pending = false;
+  }
+  spin_unlock_irq(&shadow_lock);
+
+  if(ab)
+  {
+    err = dac7612_spi_write_ab(codes, 1);
+    spin_lock_irq(&shadow_lock);
+    for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+      if(err)
+        shadow[ch].err = err;
+      else
+        dac7612_shadow_set(ch, codes[ch], 1, ktime_get());
+    spin_unlock_irq(&shadow_lock);
+  }
+  else
+  {
+    for(ch = 0; ch < DAC7612_NBR_CHANNELS; ch++)
+    {
+      if(!has[ch])
+        continue;
+
+      err = dac7612_spi_write_reg14(DAC7612_ADDR(ch), codes[ch]);
+      spin_lock_irq(&shadow_lock);
+      if(err)
+        shadow[ch].err = err;
+      else
+        dac7612_shadow_set(ch, codes[ch], 1, ktime_get());
+      spin_unlock_irq(&shadow_lock);
+    }
+  }
+
+  mutex_unlock(&shadow_bus_lock);
+}
+
+static enum hrtimer_restart dac7612_shadow_timer(struct hrtimer *timer)
+{
+  schedule_work(&shadow_work);
+  return HRTIMER_NORESTART;
+}
+
+void dac7612_shadow_init(void)
+{
+  INIT_WORK(&shadow_work, dac7612_shadow_flush);
+  hrtimer_init(&shadow_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  shadow_timer.function = dac7612_shadow_timer;
+}
+
+void dac7612_shadow_exit(void)
+{
+  hrtimer_cancel(&shadow_timer);
+  cancel_work_sync(&shadow_work);
+}
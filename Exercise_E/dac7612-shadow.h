@@ -0,0 +1,13 @@
+#ifndef DAC7612_SHADOW_H
+#define DAC7612_SHADOW_H
+#include <linux/types.h>
+#include "dac7612-uapi.h"
+
+int dac7612_shadow_write(int channel, u16 code);
+int dac7612_shadow_write_ab(const u16 *codes);
+void dac7612_shadow_note(int channel, u16 code, unsigned int n);
+void dac7612_shadow_get(int channel, struct dac7612_setpoint *sp);
+void dac7612_shadow_init(void);
+void dac7612_shadow_exit(void);
+
+#endif
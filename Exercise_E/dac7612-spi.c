@@ -1,56 +1,315 @@
+#include "mps-log.h"
 #include <linux/err.h>
+#include <linux/gpio.h>
 #include <plat/mcspi.h>
 #include <asm/uaccess.h>
 #include <linux/interrupt.h>
 #include <linux/input.h>
 #include <linux/spi/spi.h>
 #include "dac7612.h"
+#include "dac7612-stats.h"
+#include "mps-spi-arb.h"
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
 
-#define MODULE_DEBUG 1
+#define CREATE_TRACE_POINTS
+#include "dac7612-trace.h"
 
 MODULE_AUTHOR("TeamMPS");
 MODULE_LICENSE("Dual BSD/GPL");
 
 static struct spi_device *dac7612_spi_device = NULL;
 
-int dac7612_spi_write_reg14(u8 addr, u16 data)
+/*
+ * Buffers for all synchronous writes
+ * Allocated once, as transfer buffers must be DMA safe,
+ * and protected by dac7612_block_lock.
+ */
+struct dac7612_block {
+  struct spi_transfer t[DAC7612_BLOCK_MAX];
+  u16 tx[DAC7612_BLOCK_MAX] ____cacheline_aligned;
+};
+
+static struct dac7612_block *dac7612_block = NULL;
+static DEFINE_MUTEX(dac7612_block_lock);
+
+static int arb_prio = 10;
+module_param(arb_prio, int, S_IRUGO);
+MODULE_PARM_DESC(arb_prio, "SPI bus arbitration priority against other devices on the bus, higher goes first (default 10)");
+
+static struct mps_arb_client dac7612_arb = {
+  .name = "dac7612",
+};
+
+/*
+ * Messages go through the bus arbiter. With the higher
+ * priority, a DAC update goes in ahead of queued ADC traffic.
+ */
+static int dac7612_spi_sync(struct spi_message *m)
 {
-  struct spi_transfer t[2];
-  struct spi_message m;
-  u16 cmd;
+  int err;
 
-  /* Check for valid spi device */
-  if(!dac7612_spi_device)
-    return -ENODEV;
+  mps_arb_acquire(&dac7612_arb);
+  err = spi_sync(m->spi, m);
+  mps_arb_release(&dac7612_arb);
 
-  /* Create Cmd byte:
-   *
-   * | ADDR   |        DATA               |
-   * | 13 12  | 11 10 9 8 7 6 5 4 3 2 1 0 |
-   */
-  
-  cmd = (addr << 12);   // Roll addr up to bit 13 and 12
-  cmd |= (data & 0b111111111111); // Mask data, so only bit 11-0 is written to cmd
+  return err;
+}
+
+/*
+ * LOADDACS
+ * The DAC registers follow the input registers while LOADDACS is
+ * low, which is where it idles. To update both outputs at once it
+ * is held high while both input registers are written, and the
+ * falling edge transfers them together. Without loaddacs_gpio the
+ * pin is assumed tied low, and the outputs change one word time
+ * (about a microsecond) apart.
+ */
+static int loaddacs_gpio = -1;
+module_param(loaddacs_gpio, int, S_IRUGO);
+MODULE_PARM_DESC(loaddacs_gpio, "GPIO driving LOADDACS for simultaneous updates, -1 if tied low (default -1)");
+
+static bool loaddacs = false;
+
+/*
+ * Holds are counted, as writes, playback and completions may
+ * overlap. The outputs update when the last hold is released.
+ */
+static DEFINE_SPINLOCK(latch_lock);
+static unsigned int latch_holds = 0;
+
+void dac7612_spi_latch_hold(void)
+{
+  unsigned long flags;
+
+  if(!loaddacs)
+    return;
+
+  spin_lock_irqsave(&latch_lock, flags);
+  if(latch_holds++ == 0)
+    gpio_set_value(loaddacs_gpio, 1);
+  spin_unlock_irqrestore(&latch_lock, flags);
+}
+
+void dac7612_spi_latch_release(void)
+{
+  unsigned long flags;
+
+  if(!loaddacs)
+    return;
+
+  spin_lock_irqsave(&latch_lock, flags);
+  if(!WARN_ON(latch_holds == 0) && --latch_holds == 0)
+    gpio_set_value(loaddacs_gpio, 0);
+  spin_unlock_irqrestore(&latch_lock, flags);
+}
+
+/*
+ * Command word
+ *
+ * | ADDR   |        DATA               |
+ * | 13 12  | 11 10 9 8 7 6 5 4 3 2 1 0 |
+ */
+static inline u16 dac7612_spi_cmd(u8 addr, u16 data)
+{
+  return (addr << 12) | (data & 0xfff);
+}
+
+/*
+ * Send the words in b->tx as one message
+ * Chip select toggles between the words, so each is latched. This
+ * takes a transfer per word, as the DAC latches a word on the
+ * rising chip select, but all of them point into the one packed
+ * buffer. addr is for tracing only. Called with dac7612_block_lock
+ * held.
+ */
+static int dac7612_spi_send_block(struct dac7612_block *b, u8 addr, int n)
+{
+  struct spi_message m;
+  ktime_t start;
+  s64 duration_ns = 0;
+  bool timed;
+  int i, err;
 
   /* Init Message */
-  memset(&t, 0, sizeof(t)); 
+  memset(b->t, 0, n * sizeof(b->t[0]));
   spi_message_init(&m);
   m.spi = dac7612_spi_device;
 
-  if(MODULE_DEBUG)
-    printk(KERN_DEBUG "DAC7612: Write Reg14 Addr 0x%x Data 0x%02x\n Command: 0x%x\n", addr, data, cmd); 
+  for(i = 0; i < n; i++)
+  {
+    b->t[i].tx_buf = &b->tx[i];
+    b->t[i].len = 2;
+    b->t[i].cs_change = (i < n - 1);
+    spi_message_add_tail(&b->t[i], &m);
+  }
 
-  /* Configure tx/rx buffers */
-  t[0].tx_buf = &cmd;
-  t[0].rx_buf = NULL;
-  t[0].len = 2;
-  spi_message_add_tail(&t[0], &m);
+  /* Transmit SPI Data (blocking), timed only if somebody uses it */
+  timed = mps_trace_enabled(dac7612_write) || mps_trace_enabled(dac7612_block) ||
+          mps_stats_latency;
+  if(timed)
+    start = ktime_get();
+  err = dac7612_spi_sync(&m);
+  if(!err)
+    err = m.status;
+  if(timed)
+    duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+  if(n == 1)
+    trace_dac7612_write(addr, b->tx[0] & 0xfff, duration_ns, err);
+  else
+    trace_dac7612_block(addr, n, duration_ns, err);
+  dac7612_stats_xfer(n, n * 2, duration_ns, err);
 
-  /* Transmit SPI Data (blocking) */
-  spi_sync(m.spi, &m);
+  return err;
+}
 
-  return 0;
+/*
+ * Write a block of codes to one DAC register
+ * All words go in one message, so a block costs one spi_sync.
+ */
+int dac7612_spi_write_block(u8 addr, const u16 *codes, int n)
+{
+  struct dac7612_block *b = dac7612_block;
+  int i, err;
+
+  /* Check for valid spi device */
+  if(!dac7612_spi_device || !b)
+    return -ENODEV;
+
+  if(n <= 0 || n > DAC7612_BLOCK_MAX)
+    return -EINVAL;
+
+  mutex_lock(&dac7612_block_lock);
+
+  for(i = 0; i < n; i++)
+    b->tx[i] = dac7612_spi_cmd(addr, codes[i]);
+  err = dac7612_spi_send_block(b, addr, n);
+
+  mutex_unlock(&dac7612_block_lock);
+  return err;
+}
+
+/*
+ * Write (register, code) pairs in order
+ * The words are packed into the preallocated DMA safe buffer and
+ * go in one message. Single register writes use this too, so no
+ * transfer buffer is ever on the stack.
+ */
+int dac7612_spi_write_pairs(const struct dac7612_spi_pair *pairs, int n)
+{
+  struct dac7612_block *b = dac7612_block;
+  int i, err;
+
+  /* Check for valid spi device */
+  if(!dac7612_spi_device || !b)
+    return -ENODEV;
+
+  if(n <= 0 || n > DAC7612_BLOCK_MAX)
+    return -EINVAL;
+
+  mutex_lock(&dac7612_block_lock);
+
+  for(i = 0; i < n; i++)
+    b->tx[i] = dac7612_spi_cmd(pairs[i].addr, pairs[i].data);
+  err = dac7612_spi_send_block(b, pairs[0].addr, n);
+
+  mutex_unlock(&dac7612_block_lock);
+  return err;
+}
+
+int dac7612_spi_write_reg14(u8 addr, u16 data)
+{
+  struct dac7612_spi_pair pair = {
+    .addr = addr,
+    .data = data,
+  };
+
+  mps_dbg("Write Reg14 Addr 0x%x Data 0x%02x Command: 0x%x\n", addr, data,
+          dac7612_spi_cmd(addr, data));
+
+  return dac7612_spi_write_pairs(&pair, 1);
+}
+
+/*
+ * Write (A, B) code pairs, updating both outputs together
+ * With LOADDACS each pair is a message of its own, latched on
+ * release; otherwise all pairs go in one message.
+ */
+int dac7612_spi_write_ab(const u16 *codes, int npairs)
+{
+  struct dac7612_block *b = dac7612_block;
+  int i, n, done, err = 0;
+
+  /* Check for valid spi device */
+  if(!dac7612_spi_device || !b)
+    return -ENODEV;
+
+  if(npairs <= 0 || npairs * 2 > DAC7612_BLOCK_MAX)
+    return -EINVAL;
+
+  mutex_lock(&dac7612_block_lock);
+
+  for(done = 0; done < npairs && !err; done += n)
+  {
+    n = loaddacs ? 1 : npairs;
+    for(i = 0; i < n; i++)
+    {
+      b->tx[2 * i] = dac7612_spi_cmd(DAC7612_CHANNEL_A, codes[2 * (done + i)]);
+      b->tx[2 * i + 1] = dac7612_spi_cmd(DAC7612_CHANNEL_B, codes[2 * (done + i) + 1]);
+    }
+
+    dac7612_spi_latch_hold();
+    err = dac7612_spi_send_block(b, 0, 2 * n);
+    dac7612_spi_latch_release();
+  }
+
+  mutex_unlock(&dac7612_block_lock);
+  return err;
+}
+
+/*
+ * Bus for asynchronous messages
+ * The bus must be taken before dac7612_spi_async() and stays
+ * taken until the message completes, so a completion callback
+ * unlocks it, as does the caller if queueing fails. Several
+ * messages may share one lock, released with the last of them. Timer driven
+ * output, which can not sleep, uses trylock and treats a bus held
+ * by another device like an update still in flight.
+ */
+bool dac7612_spi_bus_trylock(void)
+{
+  return mps_arb_try_acquire(&dac7612_arb);
+}
+
+void dac7612_spi_bus_lock(void)
+{
+  mps_arb_acquire(&dac7612_arb);
+}
+
+void dac7612_spi_bus_unlock(void)
+{
+  mps_arb_release(&dac7612_arb);
+}
+
+bool dac7612_spi_bus_contended(void)
+{
+  return mps_arb_contended(&dac7612_arb);
+}
+
+/*
+ * Queue a message without waiting
+ * May be called from interrupt context, with the bus taken.
+ */
+int dac7612_spi_async(struct spi_message *m)
+{
+  if(!dac7612_spi_device)
+    return -ENODEV;
+
+  m->spi = dac7612_spi_device;
+  return spi_async(dac7612_spi_device, m);
 }
 
 /*
@@ -60,9 +319,36 @@ int dac7612_spi_write_reg14(u8 addr, u16 data)
  */
 static int __devinit dac7612_spi_probe(struct spi_device *spi)
 {
+  int err;
+
   spi->bits_per_word = 14;  
   spi_setup(spi);
 
+  dac7612_arb.prio = arb_prio;
+  err = mps_arb_register(&dac7612_arb, spi);
+  if(err)
+    return err;
+
+  /* LOADDACS idles low, the outputs follow every write */
+  if(loaddacs_gpio >= 0)
+  {
+    err = gpio_request_one(loaddacs_gpio, GPIOF_OUT_INIT_LOW, "dac7612-loaddacs");
+    if(err)
+    {
+      mps_arb_unregister(&dac7612_arb);
+      return err;
+    }
+
+    /* Also driven from the playback timer */
+    if(gpio_cansleep(loaddacs_gpio))
+    {
+      gpio_free(loaddacs_gpio);
+      mps_arb_unregister(&dac7612_arb);
+      return -EINVAL;
+    }
+    loaddacs = true;
+  }
+
   /* In this case we assume just one device */ 
   dac7612_spi_device = spi;  
   
@@ -71,8 +357,13 @@ static int __devinit dac7612_spi_probe(struct spi_device *spi)
 
 static int __devexit dac7612_remove(struct spi_device *spi)
 {
-  printk (KERN_ALERT "dac7612 SPI driver has been removed while in use\n");
+  mps_info("dac7612 SPI driver has been removed while in use\n");
   
+  if(loaddacs)
+    gpio_free(loaddacs_gpio);
+  loaddacs = false;
+
+  mps_arb_unregister(&dac7612_arb);
   dac7612_spi_device = 0;
   return 0;
 }
@@ -100,10 +391,14 @@ int dac7612_spi_init(void)
   
   int err;
 
+  dac7612_block = kzalloc(sizeof(*dac7612_block), GFP_KERNEL);
+  if(!dac7612_block)
+    return -ENOMEM;
+
   err = spi_register_driver(&dac7612_spi_driver);
   
   if(err<0)
-    printk (KERN_ALERT "Error %d registering the dac7612 SPI driver\n", err);
+    mps_err("Error %d registering the dac7612 SPI driver\n", err);
   
   /* 
    * Probe should have been called if a device is available 
@@ -115,6 +410,12 @@ int dac7612_spi_init(void)
     spi_unregister_driver(&dac7612_spi_driver); 
     err = -ENODEV;
   }
+
+  if(err)
+  {
+    kfree(dac7612_block);
+    dac7612_block = NULL;
+  }
   
   return err;
 }
@@ -127,5 +428,8 @@ int dac7612_spi_exit(void)
    */
   spi_unregister_driver(&dac7612_spi_driver); 
 
+  kfree(dac7612_block);
+  dac7612_block = NULL;
+
   return 0;
 }
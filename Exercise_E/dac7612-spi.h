@@ -3,7 +3,30 @@
 #include <linux/spi/spi.h>
 #include <linux/input.h>
 
+#define DAC7612_BLOCK_MAX	256
+
+/* DAC register of channel 0 (A) and 1 (B) */
+#define DAC7612_CHANNEL_A	2
+#define DAC7612_CHANNEL_B	3
+#define DAC7612_ADDR(ch)	(DAC7612_CHANNEL_A + (ch))
+
+/* One command word: DAC register and 12 bit code */
+struct dac7612_spi_pair {
+  u8 addr;
+  u16 data;
+};
+
 int dac7612_spi_write_reg14(u8 addr, u16 data);
+int dac7612_spi_write_pairs(const struct dac7612_spi_pair *pairs, int n);
+int dac7612_spi_write_block(u8 addr, const u16 *codes, int n);
+int dac7612_spi_write_ab(const u16 *codes, int npairs);
+bool dac7612_spi_bus_trylock(void);
+void dac7612_spi_bus_lock(void);
+void dac7612_spi_bus_unlock(void);
+bool dac7612_spi_bus_contended(void);
+int dac7612_spi_async(struct spi_message *m);
+void dac7612_spi_latch_hold(void);
+void dac7612_spi_latch_release(void);
 int dac7612_spi_init(void);
 int dac7612_spi_exit(void);
 
@@ -0,0 +1,53 @@
+#include <linux/module.h>
+#include "dac7612-stats.h"
+
+/*
+ * debugfs statistics, in /sys/kernel/debug/dac7612/
+ * Bus and write counters, see mps-stats.h.
+ */
+
+DEFINE_PER_CPU(struct dac7612_stats, dac7612_stats);
+
+void dac7612_stats_xfer(unsigned int writes, unsigned int bytes, s64 duration_ns, int err)
+{
+  dac7612_stats_inc(transactions);
+  dac7612_stats_add(bytes, bytes);
+  if(err)
+  {
+    dac7612_stats_inc(spi_errors);
+    return;
+  }
+
+  dac7612_stats_add(writes, writes);
+  if(mps_stats_latency)
+    dac7612_stats_inc(latency[mps_stats_bucket(duration_ns)]);
+}
+
+static void dac7612_stats_show(struct seq_file *m, const void *data)
+{
+  const struct dac7612_stats *sum = data;
+
+  seq_printf(m, "transactions %llu\n", sum->transactions);
+  seq_printf(m, "bytes %llu\n", sum->bytes);
+  seq_printf(m, "spi_errors %llu\n", sum->spi_errors);
+  seq_printf(m, "writes %llu\n", sum->writes);
+
+  mps_stats_hist_show(m, "latency_us", sum->latency);
+}
+
+static struct mps_stats dac7612_debugfs = {
+  .name     = "dac7612",
+  .counters = &dac7612_stats,
+  .size     = sizeof(struct dac7612_stats),
+  .show     = dac7612_stats_show,
+};
+
+void dac7612_stats_init(void)
+{
+  mps_stats_register(&dac7612_debugfs);
+}
+
+void dac7612_stats_exit(void)
+{
+  mps_stats_unregister(&dac7612_debugfs);
+}
@@ -0,0 +1,25 @@
+#ifndef DAC7612_STATS_H
+#define DAC7612_STATS_H
+#include "mps-stats.h"
+
+/*
+ * Per-CPU counters, summed when read through debugfs
+ */
+struct dac7612_stats {
+  u64 transactions;		/* spi_sync calls */
+  u64 bytes;			/* Bytes clocked on the bus */
+  u64 spi_errors;		/* Failed spi_sync calls */
+  u64 writes;			/* DAC register writes */
+  u64 latency[MPS_STATS_BUCKETS]; /* Write latency */
+};
+
+DECLARE_PER_CPU(struct dac7612_stats, dac7612_stats);
+
+#define dac7612_stats_inc(field)	mps_stats_inc(dac7612_stats, field)
+#define dac7612_stats_add(field, n)	mps_stats_add(dac7612_stats, field, n)
+
+void dac7612_stats_xfer(unsigned int writes, unsigned int bytes, s64 duration_ns, int err);
+void dac7612_stats_init(void);
+void dac7612_stats_exit(void);
+
+#endif
@@ -0,0 +1,60 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dac7612
+
+#if !defined(DAC7612_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define DAC7612_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * DAC7612 tracepoints
+ * Enable with e.g. "trace-cmd record -e dac7612" or
+ * "perf record -e 'dac7612:*'".
+ */
+
+TRACE_EVENT(dac7612_write,
+  TP_PROTO(u8 addr, u16 data, s64 duration_ns, int status),
+  TP_ARGS(addr, data, duration_ns, status),
+  TP_STRUCT__entry(
+    __field(u8, addr)
+    __field(u16, data)
+    __field(s64, duration_ns)
+    __field(int, status)
+  ),
+  TP_fast_assign(
+    __entry->addr = addr;
+    __entry->data = data;
+    __entry->duration_ns = duration_ns;
+    __entry->status = status;
+  ),
+  TP_printk("addr=%u data=%u duration_ns=%lld status=%d",
+            __entry->addr, __entry->data, __entry->duration_ns, __entry->status)
+);
+
+TRACE_EVENT(dac7612_block,
+  TP_PROTO(u8 addr, int n, s64 duration_ns, int status),
+  TP_ARGS(addr, n, duration_ns, status),
+  TP_STRUCT__entry(
+    __field(u8, addr)
+    __field(int, n)
+    __field(s64, duration_ns)
+    __field(int, status)
+  ),
+  TP_fast_assign(
+    __entry->addr = addr;
+    __entry->n = n;
+    __entry->duration_ns = duration_ns;
+    __entry->status = status;
+  ),
+  TP_printk("addr=%u n=%d duration_ns=%lld status=%d",
+            __entry->addr, __entry->n, __entry->duration_ns, __entry->status)
+);
+
+#endif /* DAC7612_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dac7612-trace
+#include <trace/define_trace.h>
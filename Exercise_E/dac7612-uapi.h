@@ -0,0 +1,301 @@
+#ifndef DAC7612_UAPI_H
+#define DAC7612_UAPI_H
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * DAC7612 user space interface
+ * Shared between the driver and applications using the
+ * /dev/dac* device nodes.
+ */
+#define DAC7612_NBR_CHANNELS		2
+#define DAC7612_CODE_MAX		4095
+
+/*
+ * Write mode, selected per open file
+ *
+ * TEXT:   write() takes a single decimal or hex value (default).
+ * BINARY: write() takes an array of __u16 codes, which are output
+ *         in order as fast as the bus allows. Bits above bit 11
+ *         are ignored; the length must be a multiple of 2.
+ * MV, UV: as TEXT, but the value is an output voltage in millivolts
+ *         or microvolts, converted with the channel calibration.
+ *
+ * /dev/dacAB updates both channels together: text mode takes a
+ * pair "A B", binary mode an array of (A, B) __u16 pairs. With
+ * LOADDACS wired to a GPIO (loaddacs_gpio) both outputs change on
+ * the same edge.
+ */
+#define DAC7612_MODE_TEXT		0
+#define DAC7612_MODE_BINARY		1
+#define DAC7612_MODE_MV			2
+#define DAC7612_MODE_UV			3
+
+/*
+ * Setpoint, returned by read()
+ *
+ * TEXT:   "<code> <writes>\n" for the channel, a line per channel
+ *         on /dev/dacAB. Also in the MV and UV modes, the value is
+ *         the code.
+ * BINARY: struct dac7612_setpoint, one per channel on /dev/dacAB.
+ *
+ * Writing the value a channel already has costs no bus traffic.
+ * With min_update_us set, a value written sooner than that after
+ * the last update waits and is replaced by later values, so a
+ * burst of writes results in one update with the latest value.
+ */
+struct dac7612_setpoint {
+  __u16 code;		/* Latest value written */
+  __u16 output;		/* Value on the output */
+  __u32 pending;	/* 1 while code waits for min_update_us */
+  __u64 writes;		/* Values written to the channel */
+  __u64 bus_writes;	/* Values that went on the bus */
+};
+
+#define DAC7612_IOC_MAGIC		'D'
+#define DAC7612_IOC_SET_MODE		_IOW(DAC7612_IOC_MAGIC, 1, __u32)
+#define DAC7612_IOC_GET_MODE		_IOR(DAC7612_IOC_MAGIC, 2, __u32)
+
+/*
+ * Table playback
+ *
+ * A table of codes is loaded per channel, through the device node
+ * of that channel, and played back from a kernel timer at rate_hz.
+ * Both channels are updated on the same tick. Without
+ * DAC7612_PLAY_LOOP playback stops at the end of the longest
+ * table; shorter tables hold their last code.
+ *
+ * late_ticks counts ticks that ran more than play_late_us after
+ * they were due. underruns counts updates that could not be put
+ * on the bus in time: the previous update was still in flight, or
+ * the timer missed whole periods.
+ */
+#define DAC7612_TABLE_MAX		65536
+#define DAC7612_RATE_MAX		100000
+#define DAC7612_PLAY_LOOP		0x0001
+
+struct dac7612_table {
+  __u32 len;		/* Codes in the table, 1..DAC7612_TABLE_MAX */
+  __u32 reserved;
+  __u64 codes;		/* User pointer to __u16 codes[len] */
+};
+
+struct dac7612_play {
+  __u32 rate_hz;	/* Updates per second, 1..DAC7612_RATE_MAX */
+  __u32 flags;		/* DAC7612_PLAY_* */
+};
+
+struct dac7612_play_stats {
+  __u64 ticks;
+  __u64 late_ticks;
+  __u64 underruns;
+  __u64 max_late_ns;	/* Largest delay of a tick after it was due */
+  __u32 running;
+  __u32 pos[DAC7612_NBR_CHANNELS];	/* Next index in each table */
+  __u32 reserved;
+};
+
+#define DAC7612_IOC_LOAD_TABLE		_IOW(DAC7612_IOC_MAGIC, 3, struct dac7612_table)
+#define DAC7612_IOC_PLAY_START		_IOW(DAC7612_IOC_MAGIC, 4, struct dac7612_play)
+#define DAC7612_IOC_PLAY_STOP		_IO(DAC7612_IOC_MAGIC, 5)
+#define DAC7612_IOC_PLAY_STATS		_IOR(DAC7612_IOC_MAGIC, 6, struct dac7612_play_stats)
+
+/*
+ * Function generator (DDS)
+ *
+ * Instead of a table, a channel can play a waveform synthesized on
+ * every playback tick from a 32 bit phase accumulator:
+ *
+ *   code = offset + amplitude * wave(phase)
+ *
+ * clamped to 0..DAC7612_CODE_MAX, with wave() in -1..1. Both
+ * channels advance on the same tick, so they stay phase locked;
+ * with DAC7612_DDS_SYNC the accumulators of both channels are reset
+ * together, leaving exactly their phase offsets between them. New
+ * settings take effect between two ticks and the accumulator is
+ * not reset, so changes are phase continuous. The generator runs
+ * while playback is started (DAC7612_IOC_PLAY_START).
+ */
+#define DAC7612_WAVE_NONE		0	/* Channel not generated */
+#define DAC7612_WAVE_SINE		1
+#define DAC7612_WAVE_TRIANGLE		2
+#define DAC7612_WAVE_SQUARE		3
+#define DAC7612_WAVE_SAWTOOTH		4
+
+#define DAC7612_DDS_SYNC		0x0001
+
+struct dac7612_dds {
+  __u32 waveform;	/* DAC7612_WAVE_* */
+  __u32 freq_mhz;	/* Frequency in mHz, below half the playback rate */
+  __u32 amplitude;	/* Peak amplitude in codes, 0..2048 */
+  __u32 offset;		/* Center code, 0..DAC7612_CODE_MAX */
+  __u32 phase;		/* Phase offset in 1/65536 turns */
+  __u32 flags;		/* DAC7612_DDS_* */
+};
+
+#define DAC7612_IOC_DDS_SET		_IOW(DAC7612_IOC_MAGIC, 7, struct dac7612_dds)
+#define DAC7612_IOC_DDS_GET		_IOR(DAC7612_IOC_MAGIC, 8, struct dac7612_dds)
+
+/*
+ * Output ring
+ *
+ * For long streams that are neither tables nor waveforms. The ring
+ * is set up with DAC7612_IOC_RING_SETUP and mmap'ed read-write from
+ * offset 0: a header page followed at data_offset by frames of one
+ * code per channel. User space writes frames and advances producer;
+ * every playback tick outputs one frame on the channels in
+ * channel_mask and advances consumer. A tick that finds the ring
+ * empty holds the outputs and counts an underrun. poll() reports
+ * POLLOUT while at most low_watermark frames are queued.
+ *
+ * Setting up with frames = 0 removes the ring, which is only
+ * possible while it is not mapped.
+ */
+#define DAC7612_RING_MAGIC		0x44524e47	/* "DRNG" */
+#define DAC7612_RING_MAX		(1 << 20)
+
+struct dac7612_ring_setup {
+  __u32 frames;		/* Power of two, up to DAC7612_RING_MAX, or 0 */
+  __u32 channel_mask;	/* Channels output from the ring */
+  __u32 low_watermark;	/* Fill level that wakes poll() */
+  __u32 reserved;
+};
+
+struct dac7612_ring_header {
+  __u32 magic;		/* DAC7612_RING_MAGIC */
+  __u32 frames;
+  __u32 data_offset;	/* Offset of the first frame in the mapping */
+  __u32 low_watermark;
+  __u32 producer;	/* Next frame to write, advanced by user space */
+  __u32 consumer;	/* Next frame to output, advanced by the driver */
+  __u64 underruns;	/* Ticks that found the ring empty */
+};
+
+struct dac7612_ring_frame {
+  __u16 code[DAC7612_NBR_CHANNELS];
+};
+
+#define DAC7612_IOC_RING_SETUP		_IOW(DAC7612_IOC_MAGIC, 9, struct dac7612_ring_setup)
+
+/*
+ * Asynchronous text writes
+ *
+ * DAC7612_IOC_SET_ASYNC gives the file a pool of depth update
+ * requests, 1..DAC7612_ASYNC_MAX, or 0 to go back to synchronous
+ * writes. A text write then returns as soon as the update is
+ * queued; it waits for a free request when all are on the bus, or
+ * fails with EAGAIN on an O_NONBLOCK file. fsync() waits until
+ * every queued update has been sent.
+ *
+ * A failed update is reported by the next write(), fsync() or
+ * DAC7612_IOC_SET_ASYNC on the file. Asynchronous writes are not
+ * skipped or coalesced. Binary writes stay synchronous.
+ */
+#define DAC7612_ASYNC_MAX		64
+
+#define DAC7612_IOC_SET_ASYNC		_IOW(DAC7612_IOC_MAGIC, 10, __u32)
+
+/*
+ * Command lists
+ *
+ * DAC7612_IOC_SEQ_START runs a list of entries from an hrtimer,
+ * replacing a list still running. Each entry is output delay_ns
+ * after the previous one, the first delay_ns after the start. Due
+ * times are counted from the start, so a late entry does not delay
+ * the ones after it. Entries with no delay go out in the same
+ * message as the one before them. An entry due while the previous
+ * update is still on the bus waits for it.
+ *
+ * The list runs once; DAC7612_IOC_SEQ_ABORT stops it early.
+ * DAC7612_IOC_SEQ_TIMES copies the time each entry was actually
+ * output, relative to the start, into the __u64 array at times.
+ * It returns the number of entries copied, which only covers
+ * entries already output.
+ */
+#define DAC7612_SEQ_MAX			4096
+
+#define DAC7612_SEQ_IDLE		0
+#define DAC7612_SEQ_RUNNING		1
+#define DAC7612_SEQ_DONE		2
+#define DAC7612_SEQ_ABORTED		3
+#define DAC7612_SEQ_FAILED		4
+
+struct dac7612_seq_entry {
+  __u16 channel;	/* 0 (A) or 1 (B) */
+  __u16 code;		/* 0..DAC7612_CODE_MAX */
+  __u32 reserved;
+  __u64 delay_ns;	/* After the previous entry */
+};
+
+struct dac7612_seq {
+  __u32 len;		/* Entries, 1..DAC7612_SEQ_MAX */
+  __u32 flags;		/* None defined, must be 0 */
+  __u64 entries;	/* User pointer to struct dac7612_seq_entry[len] */
+};
+
+struct dac7612_seq_status {
+  __u32 state;		/* DAC7612_SEQ_* */
+  __u32 len;
+  __u32 done;		/* Entries output */
+  __s32 error;		/* Negative errno if FAILED */
+  __u64 requested_ns;	/* Due time of the last entry output */
+  __u64 actual_ns;	/* Time it was output */
+  __u64 late_entries;	/* Output more than seq_late_us after due */
+  __u64 max_late_ns;
+  __u64 total_late_ns;
+  __u64 bus_retries;	/* Ticks that found another device on the bus */
+};
+
+struct dac7612_seq_times {
+  __u32 first;		/* Index of the first entry */
+  __u32 len;		/* Size of times */
+  __u64 times;		/* User pointer to __u64[len] */
+};
+
+#define DAC7612_IOC_SEQ_START		_IOW(DAC7612_IOC_MAGIC, 11, struct dac7612_seq)
+#define DAC7612_IOC_SEQ_ABORT		_IO(DAC7612_IOC_MAGIC, 12)
+#define DAC7612_IOC_SEQ_STATUS		_IOR(DAC7612_IOC_MAGIC, 13, struct dac7612_seq_status)
+#define DAC7612_IOC_SEQ_TIMES		_IOW(DAC7612_IOC_MAGIC, 14, struct dac7612_seq_times)
+
+/*
+ * Channel calibration, for the MV and UV write modes
+ *
+ * The measured output voltage at code 0 and at DAC7612_CODE_MAX,
+ * which may be below the former for an inverting stage. The
+ * default is the internal reference: 0 to 4.095 V, 1 mV per code.
+ * Voltages outside the range are clamped to its ends and counted.
+ * Setting the calibration clears the counts.
+ */
+struct dac7612_cal {
+  __s32 zero_uv;	/* Output at code 0 */
+  __s32 full_uv;	/* Output at DAC7612_CODE_MAX */
+  __u64 saturated_low;	/* Values clamped to the zero_uv end */
+  __u64 saturated_high;	/* Values clamped to the full_uv end */
+};
+
+#define DAC7612_IOC_SET_CAL		_IOW(DAC7612_IOC_MAGIC, 15, struct dac7612_cal)
+#define DAC7612_IOC_GET_CAL		_IOR(DAC7612_IOC_MAGIC, 16, struct dac7612_cal)
+
+#ifndef __KERNEL__
+/*
+ * Queue one frame in a mapped ring
+ * Returns 0 if the ring is full. Single producer only.
+ */
+static inline int dac7612_ring_push(volatile struct dac7612_ring_header *h,
+                                    const struct dac7612_ring_frame *frame)
+{
+  volatile struct dac7612_ring_frame *frames;
+  __u32 p = h->producer;
+
+  if(p - h->consumer >= h->frames)
+    return 0;
+
+  frames = (volatile struct dac7612_ring_frame *)((volatile char *)h + h->data_offset);
+  frames[p & (h->frames - 1)] = *frame;
+  __sync_synchronize();
+  h->producer = p + 1;
+  return 1;
+}
+#endif
+
+#endif
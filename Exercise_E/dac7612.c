@@ -1,3 +1,4 @@
+#include "mps-log.h"
 #include <linux/err.h>
 #include <linux/ctype.h>
 #include <linux/cdev.h>
@@ -5,18 +6,26 @@
 #include <linux/interrupt.h>
 #include <linux/input.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
 #include "dac7612.h"
 #include "dac7612-spi.h"
+#include "dac7612-stats.h"
+#include "dac7612-play.h"
+#include "dac7612-ring.h"
+#include "dac7612-shadow.h"
+#include "dac7612-async.h"
+#include "dac7612-seq.h"
+#include "dac7612-cal.h"
+#include "dac7612-uapi.h"
 
 #define DAC7612_MAJOR 60
 #define DAC7612_MINOR 0
 #define MAXLEN 64
 #define COMPLIMENTARY_BIT 11
-#define DAC7612_AMOUNT 2
-#define MODULE_DEBUG 1
+#define DAC7612_AB_MINOR 2
+#define DAC7612_AMOUNT 3
 #define USECDEV 0
-#define DAC7612_CHANNEL_A 2
-#define DAC7612_CHANNEL_B 3
 
 MODULE_AUTHOR("TeamMPS");
 MODULE_LICENSE("Dual BSD/GPL");
@@ -25,22 +34,27 @@ static struct cdev dac7612Dev;
 struct file_operations dac7612_Fops;
 static int devno;
 
-#define ERRGOTO(label, ...)                     \
-  {                                             \
-  printk (__VA_ARGS__);                         \
-  goto label;                                   \
-  } while(0)
-
 static int __init dac7612_cdrv_init(void)
 {
   int err;	// Error variable
   
-  printk("dac7612 driver initializing\n");  
+  mps_info("dac7612 driver initializing\n");  
+
+  dac7612_stats_init();
+  dac7612_shadow_init();
+  dac7612_cal_init();
 
   err=dac7612_spi_init();
   if(err)
     ERRGOTO(error, "Failed SPI Initialization\n");
 
+  err = dac7612_play_init();
+  if(err)
+    ERRGOTO(err_spi_init, "Failed playback initialization\n");
+
+  err = dac7612_seq_init();
+  if(err)
+    ERRGOTO(err_play_init, "Failed command list initialization\n");
   
   /* Allocate chrdev region */
 
@@ -48,7 +62,7 @@ static int __init dac7612_cdrv_init(void)
 
   err = register_chrdev_region(devno, DAC7612_AMOUNT, "dac7612"); 
   if(err)
-    ERRGOTO(err_spi_init, "Failed registering char region (%d,%d) +%d, error %d\n",
+    ERRGOTO(err_seq_init, "Failed registering char region (%d,%d) +%d, error %d\n",
             DAC7612_MAJOR, DAC7612_MINOR, DAC7612_AMOUNT, err);
   
   /* Register Char Device */
@@ -62,37 +76,72 @@ static int __init dac7612_cdrv_init(void)
   err_register:
   unregister_chrdev_region(devno, DAC7612_AMOUNT);
 
+  err_seq_init:
+  dac7612_seq_exit();
+
+  err_play_init:
+  dac7612_play_exit();
+  dac7612_ring_exit();
+
   err_spi_init:
+  dac7612_shadow_exit();
   dac7612_spi_exit();
   
   
   error:
+  dac7612_stats_exit();
   return err;
 }
 
 static void __exit dac7612_cdrv_exit(void)
 {
-  printk("dac7612 driver Exit\n");
+  mps_info("dac7612 driver Exit\n");
   cdev_del(&dac7612Dev);
 
   unregister_chrdev_region(devno, DAC7612_AMOUNT);
 
+  dac7612_seq_exit();
+  dac7612_play_exit();
+  dac7612_ring_exit();
+  dac7612_shadow_exit();
   dac7612_spi_exit();
+  dac7612_stats_exit();
 }
 
+/*
+ * Per open file state
+ */
+struct dac7612_file {
+  struct mutex lock;		/* Serializes write() and ioctl() on the file */
+  int channel;			/* Channel of the minor, DAC7612_NBR_CHANNELS for both */
+  u32 mode;			/* DAC7612_MODE_* */
+  u16 *codes;			/* Binary write buffer, DAC7612_BLOCK_MAX codes */
+  struct dac7612_async *async;	/* Request pool of asynchronous writes, or NULL */
+};
+
 int dac7612_cdrv_open(struct inode *inode, struct file *filep)
 {
   int major = imajor(inode);
   int minor = iminor(inode);
+  struct dac7612_file *f;
 
-  printk("Opening DAC7612 Device [major], [minor]: %i, %i\n", major, minor);
+  mps_dbg("Opening DAC7612 Device [major], [minor]: %i, %i\n", major, minor);
 
   if (minor > DAC7612_AMOUNT-1)
   {
-    printk("Minor no out of range (0-%i): %i\n", DAC7612_AMOUNT, minor);
+    mps_err_ratelimited("Minor no out of range (0-%i): %i\n", DAC7612_AMOUNT, minor);
     return -ENODEV;
   }
 
+  f = kzalloc(sizeof(*f), GFP_KERNEL);
+  if(!f)
+    return -ENOMEM;
+
+  mutex_init(&f->lock);
+  f->channel = minor == DAC7612_AB_MINOR ? DAC7612_NBR_CHANNELS : minor;
+  f->mode = DAC7612_MODE_TEXT;
+
+  filep->private_data = f;
   return 0;
 }
 
@@ -100,54 +149,370 @@ int dac7612_cdrv_release(struct inode *inode, struct file *filep)
 {
   int major = imajor(inode);
   int minor = iminor(inode);
+  struct dac7612_file *f = filep->private_data;
 
-  printk("Closing DAC7612 Device [major], [minor]: %i, %i\n", major, minor);
+  mps_dbg("Closing DAC7612 Device [major], [minor]: %i, %i\n", major, minor);
 
-  if (minor > DAC7612_AMOUNT-1)
-    return -ENODEV;
+  /* Updates still queued are sent before the pool goes */
+  dac7612_async_free(f->async);
+  kfree(f->codes);
+  kfree(f);
+  filep->private_data = NULL;
     
   return 0;
 }
 
-ssize_t dac7612_cdrv_write(struct file *filep, const char __user *ubuf, 
-                           size_t count, loff_t *f_pos)
+/* Code of a text value, in the unit of the file's mode */
+static u16 dac7612_text_code(struct dac7612_file *f, int channel, int value)
+{
+  switch(f->mode)
+  {
+    case DAC7612_MODE_MV:
+      return dac7612_cal_code(channel, (s64)value * 1000);
+    case DAC7612_MODE_UV:
+      return dac7612_cal_code(channel, value);
+    default:
+      return value;
+  }
+}
+
+static ssize_t dac7612_write_text(struct dac7612_file *f, const char __user *ubuf,
+                                  size_t count, bool nonblock)
 {
-  int minor, len, value, addr;
+  int len, value, pair[2], err;
+  u16 codes[2];
   char kbuf[MAXLEN];    
-    
-  minor = MINOR(filep->f_dentry->d_inode->i_rdev);
  
-  len = count < MAXLEN ? count : MAXLEN;
+  len = count < MAXLEN - 1 ? count : MAXLEN - 1;
 
   if(copy_from_user(kbuf, ubuf, len))
     return -EFAULT;
 	
   kbuf[len] = '\0';   // Pad null termination to string
 
-  if(MODULE_DEBUG)
-    printk("string from user: %s\n", kbuf);
+  mps_dbg("string from user: %s\n", kbuf);
+
+  /* Both channels take a pair "A B", updated together */
+  if(f->channel == DAC7612_NBR_CHANNELS)
+  {
+    if(sscanf(kbuf, "%i %i", &pair[0], &pair[1]) != 2)
+      return -EINVAL;
+
+    codes[0] = dac7612_text_code(f, 0, pair[0]);
+    codes[1] = dac7612_text_code(f, 1, pair[1]);
+    if(f->async)
+      err = dac7612_async_write(f->async, f->channel, codes, nonblock);
+    else
+      err = dac7612_shadow_write_ab(codes);
+    return err ? err : count;
+  }
+
+  if(sscanf(kbuf,"%i", &value) != 1)
+    return -EINVAL;
 
-  sscanf(kbuf,"%i", &value);
+  mps_dbg("Writing %i to dac7612 [Channel] %i \n", value, f->channel);
 
-  printk(KERN_ALERT "Writing %i to dac7612 [Minor] %i \n", value, minor);
+  codes[0] = dac7612_text_code(f, f->channel, value);
+  if(f->async)
+    err = dac7612_async_write(f->async, f->channel, codes, nonblock);
+  else  // Unchanged values are skipped, bursts coalesced
+    err = dac7612_shadow_write(f->channel, codes[0]);
+  if(err)
+    return err;
+  
+  return count;
+}
+
+/*
+ * Binary mode
+ * Codes are copied in blocks, each written in one SPI message.
+ * A partial write is returned if the bus fails after the first
+ * block. Both channels take (A, B) pairs.
+ */
+static ssize_t dac7612_write_binary(struct dac7612_file *f, const char __user *ubuf,
+                                    size_t count)
+{
+  size_t unit = sizeof(u16), total, done = 0, n;
+  int err;
+
+  if(f->channel == DAC7612_NBR_CHANNELS)
+    unit = 2 * sizeof(u16);
+  if(count % unit)
+    return -EINVAL;
+  total = count / unit;
 
-  switch (minor)
+  if(!f->codes)
   {
-    case 0:
-      addr = DAC7612_CHANNEL_A;
-      break;
-    case 1:
-      addr = DAC7612_CHANNEL_B;
-      break;
-    default:
-      printk("Unknown minor number - Address unknown %i\n", minor);
-      return -ENODEV;
+    f->codes = kmalloc(DAC7612_BLOCK_MAX * sizeof(u16), GFP_KERNEL);
+    if(!f->codes)
+      return -ENOMEM;
   }
-  
-  // Calling the spi write function with address and value:
-  dac7612_spi_write_reg14(addr, value);
-  
+
+  while(done < total)
+  {
+    n = min_t(size_t, total - done, DAC7612_BLOCK_MAX * sizeof(u16) / unit);
+    if(copy_from_user(f->codes, ubuf + done * unit, n * unit))
+    {
+      err = -EFAULT;
+      goto out;
+    }
+
+    if(f->channel == DAC7612_NBR_CHANNELS)
+    {
+      err = dac7612_spi_write_ab(f->codes, n);
+      if(!err)
+      {
+        dac7612_shadow_note(0, f->codes[2 * n - 2], n);
+        dac7612_shadow_note(1, f->codes[2 * n - 1], n);
+      }
+    }
+    else
+    {
+      err = dac7612_spi_write_block(DAC7612_ADDR(f->channel), f->codes, n);
+      if(!err)
+        dac7612_shadow_note(f->channel, f->codes[n - 1], n);
+    }
+    if(err)
+      goto out;
+    done += n;
+  }
+
   return count;
+
+out:
+  return done ? done * unit : err;
+}
+
+/*
+ * Read the setpoint
+ * Text mode gives a line per channel, continuing from f_pos
+ * so cat ends, binary mode a struct dac7612_setpoint per
+ * channel on every read.
+ */
+ssize_t dac7612_cdrv_read(struct file *filep, char __user *ubuf,
+                          size_t count, loff_t *f_pos)
+{
+  struct dac7612_file *f = filep->private_data;
+  struct dac7612_setpoint sp[DAC7612_NBR_CHANNELS];
+  char resultBuf[MAXLEN];
+  int first = f->channel, last = f->channel, ch, len = 0;
+
+  if(f->channel == DAC7612_NBR_CHANNELS)
+  {
+    first = 0;
+    last = DAC7612_NBR_CHANNELS - 1;
+  }
+
+  for(ch = first; ch <= last; ch++)
+    dac7612_shadow_get(ch, &sp[ch - first]);
+
+  if(f->mode == DAC7612_MODE_BINARY)
+  {
+    len = (last - first + 1) * sizeof(sp[0]);
+    if(count < len)
+      return -EINVAL;
+    if(copy_to_user(ubuf, sp, len))
+      return -EFAULT;
+    return len;
+  }
+
+  /* Convert to string and copy to user space */
+  for(ch = first; ch <= last; ch++)
+    len += snprintf(resultBuf + len, sizeof resultBuf - len, "%u %llu\n",
+                    sp[ch - first].code, (unsigned long long)sp[ch - first].writes);
+  len++;
+
+  return simple_read_from_buffer(ubuf, count, f_pos, resultBuf, len);
+}
+
+ssize_t dac7612_cdrv_write(struct file *filep, const char __user *ubuf, 
+                           size_t count, loff_t *f_pos)
+{
+  struct dac7612_file *f = filep->private_data;
+  ssize_t ret;
+
+  if(mutex_lock_interruptible(&f->lock))
+    return -ERESTARTSYS;
+
+  if(f->mode == DAC7612_MODE_BINARY)
+    ret = dac7612_write_binary(f, ubuf, count);
+  else
+    ret = dac7612_write_text(f, ubuf, count, filep->f_flags & O_NONBLOCK);
+
+  mutex_unlock(&f->lock);
+  return ret;
+}
+
+/*
+ * Wait for queued asynchronous writes
+ * Reports a failed update not reported yet.
+ */
+int dac7612_cdrv_fsync(struct file *filep, loff_t start, loff_t end, int datasync)
+{
+  struct dac7612_file *f = filep->private_data;
+  int err = 0;
+
+  if(mutex_lock_interruptible(&f->lock))
+    return -ERESTARTSYS;
+  if(f->async)
+    err = dac7612_async_fsync(f->async);
+  mutex_unlock(&f->lock);
+
+  return err;
+}
+
+/*
+ * Replace the request pool of the file, draining the old one
+ * depth 0 returns to synchronous writes.
+ */
+static int dac7612_set_async(struct dac7612_file *f, u32 depth)
+{
+  struct dac7612_async *a = NULL;
+  int err;
+
+  if(depth)
+  {
+    a = dac7612_async_alloc(depth);
+    if(IS_ERR(a))
+      return PTR_ERR(a);
+  }
+
+  if(mutex_lock_interruptible(&f->lock))
+  {
+    dac7612_async_free(a);
+    return -ERESTARTSYS;
+  }
+  err = dac7612_async_free(f->async);
+  f->async = a;
+  mutex_unlock(&f->lock);
+
+  return err;
+}
+
+long dac7612_cdrv_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+  struct dac7612_file *f = filep->private_data;
+  struct dac7612_play_stats stats;
+  struct dac7612_table table;
+  struct dac7612_play play;
+  struct dac7612_dds dds;
+  struct dac7612_ring_setup ring;
+  struct dac7612_seq seq;
+  struct dac7612_seq_status seq_status;
+  struct dac7612_seq_times times;
+  struct dac7612_cal cal;
+  u32 mode, depth;
+  int err;
+
+  /* Tables, generators and calibrations belong to one channel */
+  switch(cmd)
+  {
+    case DAC7612_IOC_LOAD_TABLE:
+    case DAC7612_IOC_DDS_SET:
+    case DAC7612_IOC_DDS_GET:
+    case DAC7612_IOC_SET_CAL:
+    case DAC7612_IOC_GET_CAL:
+      if(f->channel >= DAC7612_NBR_CHANNELS)
+        return -EINVAL;
+  }
+
+  switch(cmd)
+  {
+    case DAC7612_IOC_SET_MODE:
+      if(get_user(mode, (u32 __user *)arg))
+        return -EFAULT;
+      if(mode > DAC7612_MODE_UV)
+        return -EINVAL;
+
+      if(mutex_lock_interruptible(&f->lock))
+        return -ERESTARTSYS;
+      f->mode = mode;
+      mutex_unlock(&f->lock);
+      return 0;
+
+    case DAC7612_IOC_GET_MODE:
+      return put_user(f->mode, (u32 __user *)arg);
+
+    case DAC7612_IOC_SET_ASYNC:
+      if(get_user(depth, (u32 __user *)arg))
+        return -EFAULT;
+      return dac7612_set_async(f, depth);
+
+    case DAC7612_IOC_LOAD_TABLE:
+      if(copy_from_user(&table, (void __user *)arg, sizeof(table)))
+        return -EFAULT;
+      return dac7612_play_load(f->channel, (const u16 __user *)(unsigned long)table.codes,
+                               table.len);
+
+    case DAC7612_IOC_PLAY_START:
+      if(copy_from_user(&play, (void __user *)arg, sizeof(play)))
+        return -EFAULT;
+      return dac7612_play_start(&play);
+
+    case DAC7612_IOC_PLAY_STOP:
+      dac7612_play_stop();
+      return 0;
+
+    case DAC7612_IOC_DDS_SET:
+      if(copy_from_user(&dds, (void __user *)arg, sizeof(dds)))
+        return -EFAULT;
+      return dac7612_play_dds(f->channel, &dds);
+
+    case DAC7612_IOC_DDS_GET:
+      dac7612_play_dds_get(f->channel, &dds);
+      if(copy_to_user((void __user *)arg, &dds, sizeof(dds)))
+        return -EFAULT;
+      return 0;
+
+    case DAC7612_IOC_RING_SETUP:
+      if(copy_from_user(&ring, (void __user *)arg, sizeof(ring)))
+        return -EFAULT;
+      err = dac7612_ring_setup(&ring);
+      if(err)
+        return err;
+      dac7612_play_ring(ring.frames ? ring.channel_mask : 0);
+      return 0;
+
+    case DAC7612_IOC_PLAY_STATS:
+      dac7612_play_stats(&stats);
+      if(copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+        return -EFAULT;
+      return 0;
+
+    case DAC7612_IOC_SET_CAL:
+      if(copy_from_user(&cal, (void __user *)arg, sizeof(cal)))
+        return -EFAULT;
+      return dac7612_cal_set(f->channel, &cal);
+
+    case DAC7612_IOC_GET_CAL:
+      dac7612_cal_get(f->channel, &cal);
+      if(copy_to_user((void __user *)arg, &cal, sizeof(cal)))
+        return -EFAULT;
+      return 0;
+
+    case DAC7612_IOC_SEQ_START:
+      if(copy_from_user(&seq, (void __user *)arg, sizeof(seq)))
+        return -EFAULT;
+      return dac7612_seq_start(&seq);
+
+    case DAC7612_IOC_SEQ_ABORT:
+      dac7612_seq_abort();
+      return 0;
+
+    case DAC7612_IOC_SEQ_STATUS:
+      dac7612_seq_status(&seq_status);
+      if(copy_to_user((void __user *)arg, &seq_status, sizeof(seq_status)))
+        return -EFAULT;
+      return 0;
+
+    case DAC7612_IOC_SEQ_TIMES:
+      if(copy_from_user(&times, (void __user *)arg, sizeof(times)))
+        return -EFAULT;
+      return dac7612_seq_times(&times);
+
+    default:
+      return -ENOTTY;
+  }
 }
 
 struct file_operations dac7612_Fops = 
@@ -155,7 +520,13 @@ struct file_operations dac7612_Fops =
   .owner   = THIS_MODULE,
   .open    = dac7612_cdrv_open,
   .release = dac7612_cdrv_release,
+  .read    = dac7612_cdrv_read,
+  .llseek  = default_llseek,
   .write   = dac7612_cdrv_write,
+  .fsync   = dac7612_cdrv_fsync,
+  .unlocked_ioctl = dac7612_cdrv_ioctl,
+  .mmap    = dac7612_ring_mmap,
+  .poll    = dac7612_ring_poll,
 };
 
 module_init(dac7612_cdrv_init);
@@ -1,5 +1,8 @@
+insmod ../common/mps-spi-arb.ko
+insmod ../common/mps-stats.ko
 insmod hotplug_dac7612_spi_device.ko
 insmod dac7612mod.ko
 
 mknod /dev/dacA c 60 0
 mknod /dev/dacB c 60 1
+mknod /dev/dacAB c 60 2
@@ -0,0 +1,53 @@
+#ifndef MPS_LOG_H
+#define MPS_LOG_H
+
+/*
+ * Logging shared by the ADS7870 and DAC7612 drivers
+ *
+ * Include first in every source file that logs, so all messages
+ * carry the module name.
+ *
+ * mps_dbg() goes through dynamic debug: it is compiled out without
+ * CONFIG_DYNAMIC_DEBUG, and costs a single untaken branch per call
+ * site while disabled. Enable at run time with e.g.
+ *   echo 'module ads7870mod +p' > /sys/kernel/debug/dynamic_debug/control
+ *
+ * Errors that can be triggered from data paths use the rate
+ * limited variants, so a faulty bus or a misbehaving application
+ * cannot flood the console.
+ */
+#ifndef pr_fmt
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#endif
+
+#include <linux/kernel.h>
+#include <linux/printk.h>
+#include <linux/ratelimit.h>
+#include <linux/version.h>
+
+#define mps_dbg(fmt, ...)		pr_debug(fmt, ##__VA_ARGS__)
+#define mps_info(fmt, ...)		pr_info(fmt, ##__VA_ARGS__)
+#define mps_err(fmt, ...)		pr_err(fmt, ##__VA_ARGS__)
+#define mps_err_ratelimited(fmt, ...)	pr_err_ratelimited(fmt, ##__VA_ARGS__)
+#define mps_warn_ratelimited(fmt, ...)	pr_warn_ratelimited(fmt, ##__VA_ARGS__)
+
+/*
+ * True while a probe is attached to tracepoint name, for work done
+ * only to feed it, like timing a transaction.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,16,0)
+#define mps_trace_enabled(name)		trace_##name##_enabled()
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3,5,0)
+#define mps_trace_enabled(name)		static_key_false(&__tracepoint_##name.key)
+#else
+#define mps_trace_enabled(name)		static_branch(&__tracepoint_##name.key)
+#endif
+
+/* Log an error and jump to the cleanup label */
+#define ERRGOTO(label, ...)                     \
+  do {                                          \
+  mps_err(__VA_ARGS__);                         \
+  goto label;                                   \
+  } while(0)
+
+#endif
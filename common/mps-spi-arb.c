@@ -0,0 +1,285 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/module.h>
+#include "mps-spi-arb.h"
+
+MODULE_AUTHOR("TeamMPS");
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * One arbiter per SPI master, created by the first client
+ * registering on it and freed with the last.
+ *
+ * /sys/kernel/debug/mps_spi_arb/clients lists the bus wait
+ * time of every client.
+ */
+struct mps_arb {
+  struct spi_master *master;
+  struct list_head node;
+  struct list_head clients;
+  spinlock_t lock;		/* Protects busy, waiters and client statistics */
+  bool busy;
+  struct list_head waiters;	/* Sorted by priority, FIFO within a priority */
+};
+
+struct mps_arb_waiter {
+  struct list_head node;
+  struct mps_arb_client *client;
+  struct task_struct *task;
+  bool granted;
+};
+
+static LIST_HEAD(arb_list);
+static DEFINE_MUTEX(arb_list_lock);	/* Protects arb_list and the client lists */
+static struct dentry *arb_dir = NULL;
+
+int mps_arb_register(struct mps_arb_client *client, struct spi_device *spi)
+{
+  struct mps_arb *arb;
+  int err = 0;
+
+  mutex_lock(&arb_list_lock);
+  list_for_each_entry(arb, &arb_list, node)
+    if(arb->master == spi->master)
+      goto found;
+
+  arb = kzalloc(sizeof(*arb), GFP_KERNEL);
+  if(!arb)
+  {
+    err = -ENOMEM;
+    goto out;
+  }
+  arb->master = spi->master;
+  INIT_LIST_HEAD(&arb->clients);
+  INIT_LIST_HEAD(&arb->waiters);
+  spin_lock_init(&arb->lock);
+  list_add_tail(&arb->node, &arb_list);
+
+found:
+  client->arb = arb;
+  client->acquisitions = 0;
+  client->contended = 0;
+  client->wait_ns = 0;
+  client->wait_max_ns = 0;
+  list_add_tail(&client->node, &arb->clients);
+out:
+  mutex_unlock(&arb_list_lock);
+  return err;
+}
+EXPORT_SYMBOL(mps_arb_register);
+
+void mps_arb_unregister(struct mps_arb_client *client)
+{
+  struct mps_arb *arb = client->arb;
+
+  if(!arb)
+    return;
+
+  mutex_lock(&arb_list_lock);
+  list_del(&client->node);
+  client->arb = NULL;
+  if(list_empty(&arb->clients))
+  {
+    list_del(&arb->node);
+    kfree(arb);
+  }
+  mutex_unlock(&arb_list_lock);
+}
+EXPORT_SYMBOL(mps_arb_unregister);
+
+/*
+ * Acquire / Release
+ * Acquire sleeps until the bus is free, so it must be called
+ * from process context. Release does not sleep and may be
+ * called from an SPI completion callback.
+ */
+void mps_arb_acquire(struct mps_arb_client *client)
+{
+  struct mps_arb *arb = client->arb;
+  struct mps_arb_waiter w, *pos;
+  unsigned long flags;
+  ktime_t start;
+  u64 waited;
+
+  if(!arb)
+    return;
+
+  spin_lock_irqsave(&arb->lock, flags);
+  client->acquisitions++;
+  if(!arb->busy)
+  {
+    arb->busy = true;
+    spin_unlock_irqrestore(&arb->lock, flags);
+    return;
+  }
+
+  /* Queue behind waiters of the same or higher priority */
+  w.client = client;
+  w.task = current;
+  w.granted = false;
+  list_for_each_entry(pos, &arb->waiters, node)
+    if(pos->client->prio < client->prio)
+      break;
+  list_add_tail(&w.node, &pos->node);
+
+  start = ktime_get();
+  for(;;)
+  {
+    set_current_state(TASK_UNINTERRUPTIBLE);
+    if(w.granted)
+      break;
+    spin_unlock_irqrestore(&arb->lock, flags);
+    schedule();
+    spin_lock_irqsave(&arb->lock, flags);
+  }
+  __set_current_state(TASK_RUNNING);
+
+  waited = ktime_to_ns(ktime_sub(ktime_get(), start));
+  client->contended++;
+  client->wait_ns += waited;
+  if(waited > client->wait_max_ns)
+    client->wait_max_ns = waited;
+  spin_unlock_irqrestore(&arb->lock, flags);
+}
+EXPORT_SYMBOL(mps_arb_acquire);
+
+/*
+ * Acquire the bus only if it is free, without sleeping
+ * A free bus has no waiters, so this never overtakes one.
+ */
+bool mps_arb_try_acquire(struct mps_arb_client *client)
+{
+  struct mps_arb *arb = client->arb;
+  unsigned long flags;
+  bool taken;
+
+  if(!arb)
+    return true;
+
+  spin_lock_irqsave(&arb->lock, flags);
+  taken = !arb->busy;
+  if(taken)
+  {
+    arb->busy = true;
+    client->acquisitions++;
+  }
+  spin_unlock_irqrestore(&arb->lock, flags);
+
+  return taken;
+}
+EXPORT_SYMBOL(mps_arb_try_acquire);
+
+/*
+ * Another client waits for the bus
+ * Lets a client holding the bus across several messages
+ * give it up early.
+ */
+bool mps_arb_contended(struct mps_arb_client *client)
+{
+  struct mps_arb *arb = client->arb;
+  unsigned long flags;
+  bool contended;
+
+  if(!arb)
+    return false;
+
+  spin_lock_irqsave(&arb->lock, flags);
+  contended = !list_empty(&arb->waiters);
+  spin_unlock_irqrestore(&arb->lock, flags);
+
+  return contended;
+}
+EXPORT_SYMBOL(mps_arb_contended);
+
+void mps_arb_release(struct mps_arb_client *client)
+{
+  struct mps_arb *arb = client->arb;
+  struct mps_arb_waiter *w;
+  unsigned long flags;
+
+  if(!arb)
+    return;
+
+  spin_lock_irqsave(&arb->lock, flags);
+  if(list_empty(&arb->waiters))
+  {
+    arb->busy = false;
+  }
+  else
+  {
+    /* Hand the bus over, it stays busy */
+    w = list_first_entry(&arb->waiters, struct mps_arb_waiter, node);
+    list_del(&w->node);
+    w->granted = true;
+    wake_up_process(w->task);
+  }
+  spin_unlock_irqrestore(&arb->lock, flags);
+}
+EXPORT_SYMBOL(mps_arb_release);
+
+static int mps_arb_show(struct seq_file *m, void *v)
+{
+  struct mps_arb_client *c;
+  struct mps_arb *arb;
+  unsigned long flags;
+
+  mutex_lock(&arb_list_lock);
+  list_for_each_entry(arb, &arb_list, node)
+  {
+    seq_printf(m, "spi%u:\n", arb->master->bus_num);
+    list_for_each_entry(c, &arb->clients, node)
+    {
+      spin_lock_irqsave(&arb->lock, flags);
+      seq_printf(m, "  %-10s prio %3i  acquisitions %llu  contended %llu  wait_ns %llu  wait_max_ns %llu\n",
+                 c->name, c->prio, c->acquisitions, c->contended, c->wait_ns, c->wait_max_ns);
+      spin_unlock_irqrestore(&arb->lock, flags);
+    }
+  }
+  mutex_unlock(&arb_list_lock);
+
+  return 0;
+}
+
+static int mps_arb_open(struct inode *inode, struct file *file)
+{
+  return single_open(file, mps_arb_show, NULL);
+}
+
+static const struct file_operations mps_arb_fops = {
+  .owner   = THIS_MODULE,
+  .open    = mps_arb_open,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
+static int __init mps_arb_init(void)
+{
+  /* Arbitration works without the clients file */
+  arb_dir = debugfs_create_dir("mps_spi_arb", NULL);
+  if(IS_ERR_OR_NULL(arb_dir))
+  {
+    arb_dir = NULL;
+    return 0;
+  }
+
+  debugfs_create_file("clients", S_IRUGO, arb_dir, NULL, &mps_arb_fops);
+  return 0;
+}
+
+static void __exit mps_arb_exit(void)
+{
+  debugfs_remove_recursive(arb_dir);
+}
+
+module_init(mps_arb_init);
+module_exit(mps_arb_exit);
@@ -0,0 +1,42 @@
+#ifndef MPS_SPI_ARB_H
+#define MPS_SPI_ARB_H
+#include <linux/list.h>
+#include <linux/spi/spi.h>
+#include <linux/types.h>
+
+/*
+ * SPI bus arbitration between the MPS drivers
+ *
+ * Each driver registers one client for its spi_device and brackets
+ * every message with mps_arb_acquire() / mps_arb_release(). When
+ * the bus is released it is handed to the waiting client with the
+ * highest priority, so an urgent message only waits for the message
+ * on the bus, not for a whole sequence queued by another driver.
+ * Clients on different SPI masters do not contend.
+ *
+ * Messages queued from interrupt context take the bus with
+ * mps_arb_try_acquire() and release it from their completion.
+ */
+struct mps_arb;
+
+struct mps_arb_client {
+  const char *name;
+  int prio;			/* Higher goes first */
+  struct mps_arb *arb;		/* Set by mps_arb_register() */
+  struct list_head node;
+
+  /* Statistics, protected by the arbiter lock */
+  u64 acquisitions;
+  u64 contended;		/* Acquisitions that had to wait */
+  u64 wait_ns;			/* Total time spent waiting */
+  u64 wait_max_ns;
+};
+
+int mps_arb_register(struct mps_arb_client *client, struct spi_device *spi);
+void mps_arb_unregister(struct mps_arb_client *client);
+void mps_arb_acquire(struct mps_arb_client *client);
+bool mps_arb_try_acquire(struct mps_arb_client *client);
+bool mps_arb_contended(struct mps_arb_client *client);
+void mps_arb_release(struct mps_arb_client *client);
+
+#endif
@@ -0,0 +1,137 @@
+#include "mps-log.h"
+#include <linux/err.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/module.h>
+#include "mps-stats.h"
+
+MODULE_AUTHOR("TeamMPS");
+MODULE_LICENSE("Dual BSD/GPL");
+
+bool mps_stats_latency = false;
+module_param_named(latency, mps_stats_latency, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(latency, "Time bus transactions for the latency histograms, costing two clock reads each (default N)");
+EXPORT_SYMBOL(mps_stats_latency);
+
+/* Histogram bucket of a duration, log2 of microseconds */
+int mps_stats_bucket(s64 ns)
+{
+  u32 us = ns > 0 ? div_s64(ns, NSEC_PER_USEC) : 0;
+  int bucket = us > 1 ? ilog2(us) : 0;
+
+  if(bucket >= MPS_STATS_BUCKETS)
+    bucket = MPS_STATS_BUCKETS - 1;
+  return bucket;
+}
+EXPORT_SYMBOL(mps_stats_bucket);
+
+void mps_stats_hist_show(struct seq_file *m, const char *name, const u64 *hist)
+{
+  int i;
+
+  seq_printf(m, "%s:\n", name);
+  for(i = 0; i < MPS_STATS_BUCKETS - 1; i++)
+    seq_printf(m, "  %6u - %6u  %llu\n", i ? 1 << i : 0, (2 << i) - 1, hist[i]);
+
+  /* Longer durations are clamped into the last bucket */
+  seq_printf(m, "  %5s >= %6u  %llu\n", "", 1 << i, hist[i]);
+}
+EXPORT_SYMBOL(mps_stats_hist_show);
+
+static void mps_stats_sum(const struct mps_stats *stats, u64 *sum)
+{
+  size_t i, n = stats->size / sizeof(u64);
+  const u64 *c;
+  int cpu;
+
+  memset(sum, 0, stats->size);
+  for_each_possible_cpu(cpu)
+  {
+    c = per_cpu_ptr(stats->counters, cpu);
+    for(i = 0; i < n; i++)
+      sum[i] += c[i];
+  }
+}
+
+static int mps_stats_show(struct seq_file *m, void *v)
+{
+  struct mps_stats *stats = m->private;
+  u64 *sum;
+
+  sum = kmalloc(stats->size, GFP_KERNEL);
+  if(!sum)
+    return -ENOMEM;
+
+  mps_stats_sum(stats, sum);
+  stats->show(m, sum);
+
+  kfree(sum);
+  return 0;
+}
+
+static int mps_stats_open(struct inode *inode, struct file *file)
+{
+  return single_open(file, mps_stats_show, inode->i_private);
+}
+
+static const struct file_operations mps_stats_fops = {
+  .owner   = THIS_MODULE,
+  .open    = mps_stats_open,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
+static int mps_stats_reset_open(struct inode *inode, struct file *file)
+{
+  file->private_data = inode->i_private;
+  return 0;
+}
+
+static ssize_t mps_stats_reset(struct file *file, const char __user *ubuf,
+                               size_t count, loff_t *ppos)
+{
+  struct mps_stats *stats = file->private_data;
+  int cpu;
+
+  for_each_possible_cpu(cpu)
+    memset(per_cpu_ptr(stats->counters, cpu), 0, stats->size);
+
+  return count;
+}
+
+static const struct file_operations mps_stats_reset_fops = {
+  .owner = THIS_MODULE,
+  .open  = mps_stats_reset_open,
+  .write = mps_stats_reset,
+};
+
+/*
+ * Create the debugfs files of a driver
+ * The counters work without them, so a missing debugfs is not
+ * an error.
+ */
+void mps_stats_register(struct mps_stats *stats)
+{
+  stats->dir = debugfs_create_dir(stats->name, NULL);
+  if(IS_ERR_OR_NULL(stats->dir))
+  {
+    stats->dir = NULL;
+    return;
+  }
+
+  debugfs_create_file("stats", S_IRUGO, stats->dir, stats, &mps_stats_fops);
+  debugfs_create_file("reset", S_IWUSR, stats->dir, stats, &mps_stats_reset_fops);
+}
+EXPORT_SYMBOL(mps_stats_register);
+
+void mps_stats_unregister(struct mps_stats *stats)
+{
+  debugfs_remove_recursive(stats->dir);
+  stats->dir = NULL;
+}
+EXPORT_SYMBOL(mps_stats_unregister);
@@ -0,0 +1,40 @@
+#ifndef MPS_STATS_H
+#define MPS_STATS_H
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/types.h>
+
+/*
+ * debugfs statistics shared by the MPS drivers
+ *
+ * A driver keeps its counters in a per-CPU struct made only of u64
+ * fields, so the data paths update them without locks, and
+ * registers it to get
+ *
+ *   /sys/kernel/debug/<name>/stats  counters summed over all CPUs
+ *   /sys/kernel/debug/<name>/reset  write anything to clear them
+ *
+ * Only printing the summed struct is left to the driver.
+ */
+#define MPS_STATS_BUCKETS	16	/* Histogram buckets, log2 of us */
+
+/* Latency histograms are enabled, so transactions must be timed */
+extern bool mps_stats_latency;
+
+#define mps_stats_inc(var, field)	this_cpu_inc(var.field)
+#define mps_stats_add(var, field, n)	this_cpu_add(var.field, n)
+
+struct mps_stats {
+  const char *name;		/* debugfs directory */
+  void __percpu *counters;	/* Per-CPU struct of u64 */
+  size_t size;			/* sizeof that struct */
+  void (*show)(struct seq_file *m, const void *sum);
+  struct dentry *dir;
+};
+
+int mps_stats_bucket(s64 ns);
+void mps_stats_hist_show(struct seq_file *m, const char *name, const u64 *hist);
+void mps_stats_register(struct mps_stats *stats);
+void mps_stats_unregister(struct mps_stats *stats);
+
+#endif